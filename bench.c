@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "tg.h"
+
+int TG_TIMEOUT = 0;
+
+// particles are spread over a screen of this size
+#define BENCH_ROWS 60
+#define BENCH_COLS 200
+
+
+// runs 'step' over a full particle system for a number of ticks, particles
+// live for up to 'max_life' ticks and are respawned as they die
+static double step_rate(void (*step)(tg_particle_system_t*), tg_particle_layout_t layout, size_t count,
+                        float repulsion, int max_life, int ticks)
+{
+	tg_particle_system_t sys = {
+		.rng = { count },
+		.layout = layout,
+		.repulsion = repulsion,
+		.density_glyphs = " .,:;x%&##",
+	};
+
+	if (tg_particle_sys_init(&sys, count, NULL))
+	{
+		fprintf(stderr, "could not allocate %zu particles\n", count);
+		return 0;
+	}
+
+	double elapsed = 0;
+
+	for (int t = ticks; t--;)
+	{ // keep the system full
+		while ((size_t)sys._living_count < count)
+		{
+			tg_particle_t p = {
+				.pos = { (tg_rng_float(&sys.rng) + 1.f) * BENCH_COLS / 2, (tg_rng_float(&sys.rng) + 1.f) * BENCH_ROWS / 2 },
+				.vel = { tg_rng_float(&sys.rng) * 0.1f, tg_rng_float(&sys.rng) * 0.1f },
+				.life = tg_rng_below(&sys.rng, max_life),
+			};
+			tg_spawn_particle(&sys, &p);
+		}
+
+		double start = tg_time_sec();
+		step(&sys);
+		elapsed += tg_time_sec() - start;
+	}
+
+	tg_particle_sys_free(&sys);
+
+	return count * ticks / elapsed / 1e6;
+}
+
+
+void bench_particles(tg_particle_layout_t layout, size_t count, float repulsion)
+{
+	// repulsion is far more expensive, run it for fewer ticks
+	int ticks = (repulsion > 0 ? (1 << 19) : (1 << 22)) / count;
+
+	// moving on its own is where the layouts differ, updating adds the
+	// cell index. Particles die at random ages, about 1% of them each tick,
+	// or outlive the run
+	double move = step_rate(tg_move_particle_sys, layout, count, repulsion, 200, ticks);
+	double dying = step_rate(tg_update_particle_sys, layout, count, repulsion, 200, ticks);
+	double living = step_rate(tg_update_particle_sys, layout, count, repulsion, ticks + 1, ticks);
+
+	printf("%s %7zu particles, repulsion %0.1f: move %8.2f, update %7.2f, without deaths %7.2f M particles/s\n",
+	       layout == TG_PARTICLES_SOA ? "soa" : "aos", count, repulsion, move, dying, living);
+}
+
+
+void bench_rng()
+{
+	const size_t n = 1 << 22, burst = 64;
+	static float out[1 << 22];
+	tg_rng_t rng = { 0 };
+	double start, sum = 0;
+
+	start = tg_time_sec();
+	for (size_t i = 0; i < n; ++i) { out[i] = (random() % 2048) / 1024.f - 1.f; }
+	double libc = tg_time_sec() - start;
+	sum += out[n - 1];
+
+	start = tg_time_sec();
+	for (size_t i = 0; i < n; ++i) { out[i] = tg_rng_float(&rng); }
+	double single = tg_time_sec() - start;
+	sum += out[n - 1];
+
+	start = tg_time_sec();
+	for (size_t i = 0; i < n; i += burst) { tg_rng_fill_floats(&rng, out + i, burst, 1.f); }
+	double bulk = tg_time_sec() - start;
+	sum += out[n - 1];
+
+	printf("random floats: random() %7.1f, tg_rng_float %7.1f, tg_rng_fill_floats %7.1f M/s (%g)\n",
+	       n / libc / 1e6, n / single / 1e6, n / bulk / 1e6, sum);
+}
+
+
+int main(int argc, char* argv[])
+{
+	size_t counts[] = { 1024, 16384, 131072 };
+	float repulsions[] = { 0, 0.5f };
+
+	srandom(0);
+	bench_rng();
+
+	for (int r = 0; r < 2; ++r)
+	for (int c = 0; c < 3; ++c)
+	{
+		bench_particles(TG_PARTICLES_AOS, counts[c], repulsions[r]);
+		bench_particles(TG_PARTICLES_SOA, counts[c], repulsions[r]);
+	}
+
+	return 0;
+}
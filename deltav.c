@@ -9,20 +9,37 @@
 
 #include "tg.h"
 
+#define TICK_HZ 30
+
 #define CRAFT_W 32
 #define CRAFT_H 32
 
+#if CRAFT_W > 32
+#error "craft rows must fit in a craft_mask_t row"
+#endif
+
 int TG_TIMEOUT = 33333;
 
-uint8_t rand_tbl[512];
+uint8_t particle_mem[1 << 19];
 
 struct {
 	int max_rows, max_cols;
 } term = { 18, 0 };
 
+/**
+ * Occupancy of a craft's parts grid, one bit per column, along with the tight
+ * bounding box of the set bits. The box is empty when min_r > max_r.
+ */
+typedef struct {
+	uint32_t rows[CRAFT_H];
+	struct { int min_r, min_c, max_r, max_c; } box;
+} craft_mask_t;
+
 typedef struct {
 	struct { int x, y; } origin;
 	char parts[CRAFT_H][CRAFT_W];
+	craft_mask_t solid; // every part
+	craft_mask_t dock;  // docking parts, 'V' and ':'
 
 	struct { float x, y; } pos;
 	struct { float x, y; } vel;
@@ -33,7 +50,9 @@ typedef struct {
 } craft_t;
 
 
-struct termios oldt;
+
+tg_screen_t screen;
+tg_input_t input;
 
 int difficulty = 0;
 
@@ -83,26 +102,92 @@ craft_t stations[3] = {
 craft_t* station = stations + 0;
 
 tg_particle_system_t thruster_psys = {
+	.name = "thruster",
 	.start_life = 10,
 	.repulsion = 0.0f,
-	.density_glyphs = " .,:;x%&##"
+	.density_glyphs = " .,:;x%&##",
+	.style = TG_CELL(0, TG_COLOR(3), TG_DEFAULT, TG_ATTR_BOLD),
 };
 
 tg_particle_system_t crash_psys = {
+	.name = "crash",
+	.layout = TG_PARTICLES_SOA,
 	.repulsion = 0.5f,
 	.start_life = 10000,
+	.style = TG_CELL(0, TG_COLOR(1), TG_DEFAULT, 0),
 };
 
 struct {
-	time_t start_time, end_time;
+	uint64_t tick;                // ticks run, time is kept in ticks so replays match
+	uint64_t start_tick, end_tick;
+	tg_rng_t rng;
 	craft_t* crafts[10];
-	int count_down;
+	int count_down; // ticks left before the game starts
 } game = {};
 
+// the sky is layers of stars generated once per screen size, each drifting
+// a column every so many ticks, slower the farther they are, 0 for never
+#define STAR_LAYERS 2
+static const int star_drift[STAR_LAYERS] = { 12 * TICK_HZ, 4 * TICK_HZ };
+static const tg_cell_t star_cells[STAR_LAYERS] = {
+	TG_CELL('.', TG_DEFAULT, TG_DEFAULT, TG_ATTR_DIM),
+	TG_CELL('*', TG_DEFAULT, TG_DEFAULT, 0),
+};
+
+struct {
+	tg_layer_t layers[STAR_LAYERS];
+	uint64_t seed;
+} stars;
+
+struct {
+	tg_label_t vel, fuel, oxygen;
+	tg_label_t docked, crashed, suffocated;
+	tg_label_t count_down, controls, instructions;
+} hud = {
+	.vel = { 1, 1, "V: %0.2f, %0.2f Time: %d" },
+	.fuel = { 2, 1, "Fuel: [%-10.*s]", .style = TG_CELL(0, TG_COLOR(3), TG_DEFAULT, 0) },
+	.oxygen = { 3, 1, "O2:   [%-10.*s]", .style = TG_CELL(0, TG_COLOR(6), TG_DEFAULT, 0) },
+	.docked = { .fmt = "Docked! Score: %d", .mode = { .centered = 1 }, .style = TG_CELL(0, TG_COLOR(2), TG_DEFAULT, TG_ATTR_BOLD) },
+	.crashed = { .fmt = "YOU CRASHED! (ctrl-c to exit, 'r' to retry)", .mode = { .centered = 1 }, .style = TG_CELL(0, TG_COLOR(1), TG_DEFAULT, TG_ATTR_BOLD) },
+	.suffocated = { .fmt = "YOU SUFFOCATED! (ctrl-c to exit, 'r' to retry)", .mode = { .centered = 1 }, .style = TG_CELL(0, TG_COLOR(1), TG_DEFAULT, TG_ATTR_BOLD) },
+	.count_down = { .fmt = "Starting in %d", .mode = { .centered = 1 } },
+	.controls = { .fmt = "(Accelerate using i, j, k, l, f toggles stats)", .mode = { .centered = 1 } },
+	.instructions = { .fmt = "(Approach at a velocity less than 0.3)", .mode = { .centered = 1 } },
+};
+
 
 void start(void);
 
 
+void mask_set(craft_mask_t* m, int r, int c)
+{
+	m->rows[r] |= 1u << c;
+
+	if (r < m->box.min_r) { m->box.min_r = r; }
+	if (r > m->box.max_r) { m->box.max_r = r; }
+	if (c < m->box.min_c) { m->box.min_c = c; }
+	if (c > m->box.max_c) { m->box.max_c = c; }
+}
+
+
+void compute_masks(craft_t* c)
+{
+	craft_mask_t empty = { .box = { CRAFT_H, CRAFT_W, -1, -1 } };
+
+	c->solid = c->dock = empty;
+
+	for (int r = 0; r < CRAFT_H; ++r)
+	for (int col = 0; col < CRAFT_W; ++col)
+	{
+		char part = c->parts[r][col];
+		if (part == ' ' || part == '\0') { continue; }
+
+		mask_set(&c->solid, r, col);
+		if (part == 'V' || part == ':') { mask_set(&c->dock, r, col); }
+	}
+}
+
+
 void compute_origin(craft_t* c)
 {
 	int part_count = 0;
@@ -123,11 +208,20 @@ void compute_origin(craft_t* c)
 
 	c->origin.x /= part_count;
 	c->origin.y /= part_count;
+
+	compute_masks(c);
 }
 
 
 void spawn_crash(craft_t* c)
 {
+	float jitter[CRAFT_W * CRAFT_H * 2], *jit = jitter;
+	int parts = 0;
+
+	// one particle per part, draw the velocity jitter of all of them at once
+	for (int j = CRAFT_H; j--;) { parts += __builtin_popcount(c->solid.rows[j]); }
+	tg_rng_fill_floats(&crash_psys.rng, jitter, parts * 2, 0.01f);
+
 	for (int i = CRAFT_W; i--;)
 	for (int j = CRAFT_H; j--;)
 	{
@@ -138,11 +232,12 @@ void spawn_crash(craft_t* c)
 		{
 			tg_particle_t p = {
 				.pos = { c->pos.x + i - c->origin.x, c->pos.y + j - c->origin.y },
-				.vel = { c->vel.x + tg_randf() * 0.01f, c->vel.y + tg_randf() * 0.01f },
+				.vel = { c->vel.x + jit[0], c->vel.y + jit[1] },
 				.glyph = part,
 				.life = 100000,
 			};
 			tg_spawn_particle(&crash_psys, &p);
+			jit += 2;
 		}
 	}
 }
@@ -150,12 +245,18 @@ void spawn_crash(craft_t* c)
 
 void spawn_thruster_jet(float x, float y, float dx, float dy)
 {
+	float jitter[20];
+	uint8_t ages[10];
+
+	tg_rng_fill_floats(&thruster_psys.rng, jitter, 20, 0.5f);
+	tg_rng_fill_bytes(&thruster_psys.rng, ages, sizeof(ages));
+
 	for (int i = 10; i--;)
 	{
 		tg_particle_t part = {
-			.pos = { x + tg_randf() * 0.5f, y + tg_randf() * 0.5f },
+			.pos = { x + jitter[i * 2], y + jitter[i * 2 + 1] },
 			.vel = { dx, dy },
-			.life = thruster_psys.start_life + (random() % 10),
+			.life = thruster_psys.start_life + (ages[i] % 10),
 		};
 		tg_spawn_particle(&thruster_psys, &part);
 	}
@@ -176,57 +277,58 @@ int do_craft_intersect(craft_t const* c0, craft_t const* c1, int check_docking)
 {
 	if (c0->is_dead || c1->is_dead) { return 0; }
 
-	for (int c0_r = CRAFT_H; c0_r--;)
-	for (int c0_c = CRAFT_W; c0_c--;)
-	{
-		char c0_part = c0->parts[c0_r][c0_c];
-		int c0_part_x = c0->pos.x - c0->origin.x + c0_c;
-		int c0_part_y = c0->pos.y - c0->origin.y + c0_r;
+	craft_mask_t const* m0 = check_docking ? &c0->dock : &c0->solid;
+	craft_mask_t const* m1 = check_docking ? &c1->dock : &c1->solid;
 
-		if (c0_part == ' ' || c0_part == '\0') { continue; }
-		if (check_docking && (c0_part != 'V' && c0_part != ':')) { continue; }
+	if (m0->box.min_r > m0->box.max_r || m1->box.min_r > m1->box.max_r) { return 0; }
 
-		for (int c1_r = CRAFT_H; c1_r--;)
-		for (int c1_c = CRAFT_W; c1_c--;)
-		{
-			char c1_part = c1->parts[c1_r][c1_c];
-			if (check_docking && (c1_part != 'V' && c1_part != ':')) { continue; }
-			if (c1_part == ' ' || c1_part == '\0') { continue; }
-			else
-			{
-				int c1_part_x = c1->pos.x - c1->origin.x + c1_c;
-				int c1_part_y = c1->pos.y - c1->origin.y + c1_r;
+	// world position of each craft's parts grid
+	int x0 = floorf(c0->pos.x - c0->origin.x), y0 = floorf(c0->pos.y - c0->origin.y);
+	int x1 = floorf(c1->pos.x - c1->origin.x), y1 = floorf(c1->pos.y - c1->origin.y);
 
-				if (c1_part_x == c0_part_x && c1_part_y == c0_part_y)
-				{ return 1; }
-			}
-		}
+	// reject crafts whose bounding boxes don't overlap
+	if (x0 + m0->box.max_c < x1 + m1->box.min_c || x1 + m1->box.max_c < x0 + m0->box.min_c) { return 0; }
+	if (y0 + m0->box.max_r < y1 + m1->box.min_r || y1 + m1->box.max_r < y0 + m0->box.min_r) { return 0; }
+
+	// column c of c0 lines up with column c + dx of c1, likewise for rows
+	int dx = x0 - x1, dy = y0 - y1;
+	int r_start = m0->box.min_r > m1->box.min_r - dy ? m0->box.min_r : m1->box.min_r - dy;
+	int r_end = m0->box.max_r < m1->box.max_r - dy ? m0->box.max_r : m1->box.max_r - dy;
+
+	for (int r = r_start; r <= r_end; ++r)
+	{
+		uint32_t row1 = m1->rows[r + dy];
+		row1 = dx >= 0 ? row1 >> dx : row1 << -dx;
+
+		if (m0->rows[r] & row1) { return 1; }
 	}
 
 	return 0;
 }
 
 
-char sample_craft(craft_t const* c, int row, int col)
+void blit_craft(tg_screen_t* scr, craft_t const* c, float alpha)
 {
-	if (c->is_dead) { return '\0'; }
-
-	int c_col = (col - (int)c->pos.x) + c->origin.x;
-	int c_row = (row - (int)c->pos.y) + c->origin.y;
-
-	if (c_col < 0 || c_row < 0 || c_col >= CRAFT_W || c_row >= CRAFT_H) return '\0';
+	if (c->is_dead) { return; }
 
-	char part = c->parts[c_row][c_col];
+	// draw the craft where it is 'alpha' of the way to its next position
+	int x = (int)(c->pos.x + c->vel.x * alpha) - c->origin.x;
+	int y = (int)(c->pos.y + c->vel.y * alpha) - c->origin.y;
 
-	if (part == ' ') { return '\0'; }
+	for (int r = c->solid.box.min_r; r <= c->solid.box.max_r; ++r)
+	for (int col = c->solid.box.min_c; col <= c->solid.box.max_c; ++col)
+	{
+		char part = c->parts[r][col];
+		if (part == ' ' || part == '\0') { continue; }
 
-	return part;
+		tg_screen_putc(scr, y + r, x + col, part);
+	}
 }
 
 
 int compute_score(craft_t* c)
 {
-	return c->fuel - (game.end_time - game.start_time);
+	return c->fuel - (int)((game.end_tick - game.start_tick) / TICK_HZ);
 }
 
 
@@ -243,7 +345,8 @@ void update_craft(craft_t* c)
 }
 
 
-void sig_winch_hndlr(int sig)
+// the frame is a row shorter than the terminal, 80x40 when its size is unknown
+void read_term_size()
 {
 	term.max_cols = tg_term_width();
 	term.max_rows = tg_term_height() - 1;
@@ -256,37 +359,39 @@ void sig_winch_hndlr(int sig)
 }
 
 
-void sig_int_hndlr(int sig)
+void print_state()
 {
-	tg_restore_settings(&oldt);
-	exit(0);
+	printf("tick=%llu pos=%.4f,%.4f vel=%.4f,%.4f fuel=%d oxygen=%.1f dead=%d docked=%d score=%d\n",
+	       (unsigned long long)game.tick, craft.pos.x, craft.pos.y, craft.vel.x, craft.vel.y,
+	       craft.fuel, craft.oxygen, craft.is_dead, craft.is_docked, compute_score(&craft));
 }
 
 
 void input_hndlr()
 {
-	char c;
-	if (tg_key_get(&c) == 0)
-	{ // no key pressed
-		return;
-	}
-
-
+	tg_key_event_t ev;
 	float imp = 0.01f;
-	switch(c)
+
+	// every key pressed since the last tick
+	while (tg_input_next(&input, &ev))
+	switch(ev.key)
 	{ // handle key accordingly
+		case TG_KEY_UP:
                 case 'i':
 		case 'w':
 			player_thruster(0, -imp);
                         break;
+		case TG_KEY_DOWN:
                 case 'k':
 		case 's':
 			player_thruster(0, imp);
                         break;
+		case TG_KEY_LEFT:
                 case 'j':
 		case 'a':
 			player_thruster(-imp, 0);
                         break;
+		case TG_KEY_RIGHT:
                 case 'l':
 		case 'd':
 			player_thruster(imp, 0);
@@ -298,6 +403,9 @@ void input_hndlr()
 		case 'r':
 			start();
 			break;
+		case 'f':
+			tg_probes_toggle_overlay();
+			break;
 		default:
 			// TODO
 			;
@@ -305,131 +413,120 @@ void input_hndlr()
 }
 
 
-static inline const char* sampler(int row, int col)
+// generates the star layers when the screen's size changes, the same seed
+// always gives the same sky
+void generate_stars(tg_screen_t* scr)
 {
-	// return character for a given row and column in the terminal
-	static char c;
+	for (int l = 0; l < STAR_LAYERS; ++l)
+	{
+		tg_layer_t* layer = stars.layers + l;
+		if (tg_layer_resize(layer, scr->rows, scr->cols) <= 0) { continue; }
 
-	if (game.count_down > 0)
-	{ // draw the count down message
-		tg_str_t controls_str = {
-			(term.max_rows >> 1) + 2, term.max_cols >> 1,
-			"(Accelerate using i, j, k, l)",
-			.mode = { .centered = 1 },
-		};
-		tg_str_t instructions_str = {
-			(term.max_rows >> 1) + 3, term.max_cols >> 1,
-			"(Approach at a velocity less than 0.3)",
-			.mode = { .centered = 1 },
-		};
+		// the farthest layer is the opaque bottom one
+		tg_rng_t rng;
+		tg_rng_seed(&rng, stars.seed + l);
+		layer->opaque = l == 0;
 
-		tg_str_t score_str = {
-			term.max_rows >> 1, term.max_cols >> 1,
-			"Starting in %d",
-			.mode = { .centered = 1 },
-		};
+		for (int i = scr->rows * scr->cols; i--;)
+		{
+			int star = (tg_rng_next(&rng) & 127) == 0;
+			layer->cells[i] = star ? star_cells[l] : (layer->opaque ? ' ' : 0);
+		}
+	}
+}
 
-		c = tg_str(row, col, &score_str, game.count_down);
-		if (c > -1) return &c;
 
-		c = tg_str(row, col, &controls_str);
-		if (c > -1) return &c;
+void compose(tg_screen_t* scr, float alpha)
+{
+	// each layer is drawn over the last, from the background up
+	if (!stars.layers[0].cells) { tg_screen_fill(scr, " "); }
 
-		c = tg_str(row, col, &instructions_str);
-		if (c > -1) return &c;
+	for (int l = 0; l < STAR_LAYERS; ++l)
+	{
+		int drift = star_drift[l] ? (int)(game.tick / star_drift[l]) : 0;
+		tg_screen_layer(scr, stars.layers + l, 0, drift);
 	}
 
-	if (craft.is_dead)
-	{ // draw crashed string
-		tg_str_t* str_ptr = NULL;
-		tg_str_t str = {
-			term.max_rows >> 1, term.max_cols >> 1,
-			"",
-			.mode = { .centered = 1 },
-		};
+	{ // draw crafts, earlier crafts on top of later ones
+		int count = 0;
+		while (game.crafts[count]) { ++count; }
+		for (int i = count; i--;) { blit_craft(scr, game.crafts[i], alpha); }
+	}
 
-		if (craft.oxygen == 0)
-		{
-			static char suff_str[] = "YOU SUFFOCATED! (ctrl-c to exit, 'r' to retry)";
-			str.fmt = suff_str;
-		}
-		else
-		{
-			static char crash_str[] = "YOU CRASHED! (ctrl-c to exit, 'r' to retry)";
-			str.fmt = crash_str;
-		}
+	tg_screen_blit_particles(scr, &thruster_psys);
+	tg_screen_blit_particles(scr, &crash_psys);
 
-		time_t time_elapsed = game.end_time - game.start_time;
-		c = tg_str(row, col, &str);
-		if (c > -1) return &c;
-	
-	}
+	{ // draw gauges, a '#' for every 10 units left
+		static const char bar[] = "##########";
+		int fuel = craft.fuel / 10;
+		int oxygen = ceilf(craft.oxygen / 10);
 
-	if (craft.is_docked)
-	{ // draw summary 
-		tg_str_t score_str = {
-			1, term.max_cols >> 1,
-			"Docked! Score: %d",
-			.mode = { .centered = 1 },
-		};
+		if (oxygen > 10) { oxygen = 10; }
+
+		tg_label_update(&hud.oxygen, oxygen, oxygen, bar);
+		tg_screen_label(scr, &hud.oxygen);
 
-		time_t time_elapsed = game.end_time - game.start_time;
-		c = tg_str(row, col, &score_str, compute_score(&craft));
-		if (c > -1) return &c;
+		tg_label_update(&hud.fuel, fuel, fuel, bar);
+		tg_screen_label(scr, &hud.fuel);
 	}
 
 	{ // draw velocity string
-		tg_str_t vel_str = {
-			1, 1,
-			"V: %0.2f, %0.2f Time: %d",
+		struct { float x, y; int time; } inputs = {
+			craft.vel.x, craft.vel.y, (int)((game.tick - game.start_tick) / TICK_HZ)
 		};
 
-		time_t time_elapsed = time(NULL) - game.start_time;
-		c = tg_str(row, col, &vel_str, craft.vel.x, craft.vel.y, time_elapsed);
-		if (c > -1) return &c;
+		tg_label_update(&hud.vel, tg_label_key(&inputs, sizeof(inputs)), inputs.x, inputs.y, inputs.time);
+		tg_screen_label(scr, &hud.vel);
 	}
 
-	{ // draw fuel gauge
-		char str[32] = "Fuel: [          ]";
-		for (int i = 0; i < craft.fuel / 10; ++i) { str[7 + i] = '#'; }
-
-		tg_str_t fuel_str = {
-			2, 1,
-			str,	
-		};
+	if (craft.is_docked)
+	{ // draw summary
+		int score = compute_score(&craft);
 
-		c = tg_str(row, col, &fuel_str);
-		if (c > -1) return &c;
+		hud.docked.col = term.max_cols >> 1;
+		hud.docked.row = 1;
+		tg_label_update(&hud.docked, score, score);
+		tg_screen_label(scr, &hud.docked);
 	}
 
-    { // draw oxygen gauge
-		char str[32] = "O2:   [          ]";
-		for (int i = 0; i < craft.oxygen / 10; ++i) { str[7 + i] = '#'; }
-
-		tg_str_t fuel_str = {
-			3, 1,
-			str,	
-		};
+	if (craft.is_dead)
+	{ // draw crashed string
+		tg_label_t* msg = craft.oxygen == 0 ? &hud.suffocated : &hud.crashed;
 
-		c = tg_str(row, col, &fuel_str);
-		if (c > -1) return &c;
+		msg->row = term.max_rows >> 1;
+		msg->col = term.max_cols >> 1;
+		tg_screen_label(scr, msg);
 	}
-	c = tg_sample_particle_sys(&crash_psys, row, col);
-	if (c != '\0') { return &c; }
 
-	c = tg_sample_particle_sys(&thruster_psys, row, col);
-	if (c != '\0') { return &c; }
+	if (game.count_down > 0)
+	{ // draw the count down message
+		int row = term.max_rows >> 1, col = term.max_cols >> 1;
 
-	for (int i = 0; game.crafts[i]; ++i)
-	{
-		c = sample_craft(game.crafts[i], row, col);
-		if (c != '\0') { return &c; }
-	}	
+		hud.count_down.row = row;
+		hud.controls.row = row + 2;
+		hud.instructions.row = row + 3;
+		hud.count_down.col = hud.controls.col = hud.instructions.col = col;
+
+		tg_screen_label(scr, &hud.instructions);
+		tg_screen_label(scr, &hud.controls);
+
+		int seconds = (game.count_down + TICK_HZ - 1) / TICK_HZ;
+		tg_label_update(&hud.count_down, seconds, seconds);
+		tg_screen_label(scr, &hud.count_down);
+	}
+}
 
-	// render stars
-	if (rand_tbl[((row * term.max_cols) + col) % 512] < 4) { return "*"; }
 
-	return " ";
+void render(float alpha)
+{
+	// nothing moves during the count down
+	if (game.count_down > 0) { alpha = 0; }
+
+	if (tg_term_resized()) { read_term_size(); }
+	if (tg_screen_resize(&screen, term.max_rows, term.max_cols)) { return; }
+	generate_stars(&screen);
+	compose(&screen, alpha);
+	tg_screen_present(&screen);
 }
 
 
@@ -446,29 +543,31 @@ void start()
 	station->is_dead = 0;
 	station->is_docked = 0;
 
-	craft.pos.x = (random() % (term.max_cols / 2)) + term.max_cols / 4;
+	craft.pos.x = tg_rng_below(&game.rng, term.max_cols / 2) + term.max_cols / 4;
 	craft.pos.y = term.max_rows - 5;
-	craft.vel.x = ((random() % 20) - 10) / 100.f;
-	craft.vel.y = -((random() % 20)) / 100.f;
+	craft.vel.x = ((int)tg_rng_below(&game.rng, 20) - 10) / 100.f;
+	craft.vel.y = -((int)tg_rng_below(&game.rng, 20)) / 100.f;
 	craft.is_dead = 0;
 	craft.is_docked = 0;
 	//craft.fuel = compute_min_fuel(craft.vel.x, craft.vel.y) * (3.f - difficulty);
 	
-	time(&game.start_time);
+	game.start_tick = game.tick;
 
 	game.crafts[0] = &craft;
 	game.crafts[1] = station;
 
-	game.count_down = 3;
+	game.count_down = 3 * TICK_HZ;
 
 	tg_clear_particles(&crash_psys);
 }
 
 void update()
 {
-	if (game.count_down-- > 0)
+	game.tick++;
+
+	if (game.count_down > 0)
 	{
-		sleep(1);
+		game.count_down--;
 		return;
 	}
 
@@ -517,7 +616,7 @@ void update()
 			}
 			else
 			{
-				game.end_time = time(NULL);
+				game.end_tick = game.tick;
 			}
 		}
 	}
@@ -529,10 +628,23 @@ void update()
 
 int main(int argc, char* argv[])
 {
-	srandom(time(NULL));
-	signal(SIGWINCH, sig_winch_hndlr);
-	signal(SIGINT, sig_int_hndlr);
-	sig_winch_hndlr(0);
+	tg_session_t session = {
+		.name = "deltav",
+		.screen = &screen,
+		.input = &input,
+		.print_state = print_state,
+	};
+
+	read_term_size();
+	if (tg_session_begin(&session, term.max_rows, term.max_cols)) { return 1; }
+
+	term.max_rows = session.rows;
+	term.max_cols = session.cols;
+
+	tg_rng_seed(&game.rng, session.seed);
+	tg_rng_seed(&thruster_psys.rng, session.seed + 1);
+	tg_rng_seed(&crash_psys.rng, session.seed + 2);
+	stars.seed = session.seed + 3;
 
 	if (argc > 1)
 	{
@@ -548,26 +660,37 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	for (int i = sizeof(rand_tbl); i--;) { rand_tbl[i] = random() % 256; }
+	tg_arena_t particle_arena = { particle_mem, sizeof(particle_mem) };
+	if (tg_particle_sys_init(&thruster_psys, 1024, &particle_arena) ||
+	    tg_particle_sys_init(&crash_psys, 4096, &particle_arena))
+	{
+		fprintf(stderr, "deltav: particle_mem is too small for the particle systems\n");
+		return 1;
+	}
+
+	tg_session_open(&session);
 
-	tg_game_settings(&oldt);
 	compute_origin(&craft);
 	compute_origin(station);
 
 	start();
 
-	while (playing())
-	{
-		input_hndlr();
-		tg_clear(term.max_rows);
-		tg_rasterize(term.max_rows, term.max_cols, sampler);
-		update();
-	}
+	tg_loop_t loop = {
+		.tick_hz = TICK_HZ,
+		.render_hz = 60,
+		.input = input_hndlr,
+		.update = update,
+		.render = render,
+		.playing = playing,
+	};
+
+	tg_session_run(&session, &loop);
+	tg_session_end(&session, &loop);
 
-	tg_clear(term.max_rows);
-	tg_rasterize(term.max_rows, term.max_cols, sampler);
+	if (session.benchmarking) { return 0; }
 
-	tg_restore_settings(&oldt);
+	// the final frame went with the alternate screen
+	if (session.interactive && craft.is_docked) { printf("Docked! Score: %d\n", compute_score(&craft)); }
 
 	return 1;
 }
@@ -9,14 +9,18 @@
 
 #include "tg.h"
 
+int TG_TIMEOUT = 33333;
+
 struct {
 	int max_rows, max_cols;
 } term = { 18, 0 };
 
-struct termios oldt;
+tg_screen_t screen;
+tg_input_t input;
 
 
-void sig_winch_hndlr(int sig)
+// the template keeps a fixed height, only its width follows the terminal
+void read_term_size()
 {
 	term.max_cols = tg_term_width();
 	if (term.max_cols < 0)
@@ -26,22 +30,13 @@ void sig_winch_hndlr(int sig)
 }
 
 
-void sig_int_hndlr(int sig)
-{
-	tg_restore_settings(&oldt);
-	exit(1);
-}
-
-
 void input_hndlr()
 {
-	char c;
-	if (tg_key_get(&c) == 0)
-	{ // no key pressed
-		return;
-	}
+	tg_key_event_t ev;
 
-	switch(c)
+	// every key pressed since the last update
+	while (tg_input_next(&input, &ev))
+	switch(ev.key)
 	{ // handle key accordingly
 		default:
 			// TODO
@@ -50,7 +45,7 @@ void input_hndlr()
 }
 
 
-static inline char* sampler(int row, int col)
+static inline const char* sampler(int row, int col)
 {
 	// return character for a given row and column in the terminal
 	return " ";
@@ -70,23 +65,43 @@ void update()
 }
 
 
+void render(float alpha)
+{
+	// draw the game, alpha is how far into the next update we are
+	if (tg_term_resized()) { read_term_size(); }
+	tg_screen_rasterize(&screen, term.max_rows, term.max_cols, sampler);
+}
+
+
 int main(int argc, char* argv[])
 {
+	tg_session_t session = {
+		.name = "template",
+		.screen = &screen,
+		.input = &input,
+	};
 
-	signal(SIGWINCH, sig_winch_hndlr);
-	signal(SIGINT, sig_int_hndlr);
-	sig_winch_hndlr(0);
+	read_term_size();
+	if (tg_session_begin(&session, term.max_rows, term.max_cols)) { return 1; }
 
-	tg_game_settings(&oldt);
+	term.max_rows = session.rows;
+	term.max_cols = session.cols;
 
-	while (playing())
-	{
-		input_hndlr();
-		update();
-		tg_rasterize(term.max_rows, term.max_cols, sampler);
-	}
+	// set the game up, seeding its randomness with session.seed
+
+	tg_session_open(&session);
+
+	tg_loop_t loop = {
+		.tick_hz = 30,
+		.render_hz = 60,
+		.input = input_hndlr,
+		.update = update,
+		.render = render,
+		.playing = playing,
+	};
 
-	tg_restore_settings(&oldt);
+	tg_session_run(&session, &loop);
+	tg_session_end(&session, &loop);
 
 	return 1;
 }
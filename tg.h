@@ -3,17 +3,434 @@
 
 #include <unistd.h>
 #include <termios.h>
+#include <sys/ioctl.h>
 #include <term.h>
 #include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #ifdef __linux__
 #include <stdio_ext.h>
 #endif
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 
 extern int TG_TIMEOUT;
 
+/**
+ * @brief      Reads the monotonic clock.
+ *
+ * @return     Seconds since an arbitrary, fixed point in the past.
+ */
+double tg_time_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Phases of a frame timed by the probes.
+ */
+typedef enum {
+	TG_PHASE_INPUT = 0,
+	TG_PHASE_UPDATE,    // the game's update, particle updates included
+	TG_PHASE_PARTICLES, // each tg_update_particle_sys
+	TG_PHASE_SAMPLE,    // rendering a frame up to presenting it
+	TG_PHASE_FLUSH,     // tg_screen_present, diffing and writing the frame
+	TG_PHASE_FRAME,     // start of a frame to the start of the next
+	TG_PHASE_COUNT,
+} tg_phase_t;
+
+// durations kept per phase for the rolling statistics, must be a power of 2
+#define TG_PROBE_WINDOW 256
+
+/**
+ * Durations recorded for one phase. The window holds the most recent ones,
+ * the count, total and max cover the whole session.
+ */
+typedef struct {
+	float window[TG_PROBE_WINDOW];
+	uint64_t count;
+	double total;
+	double max;
+} tg_probe_t;
+
+typedef struct {
+	double min, avg, p99; // over the window
+	double max;           // over the session
+} tg_probe_stats_t;
+
+// particle systems the probes keep pool usage for
+#define TG_PROBE_SYSTEMS 8
+
+typedef struct {
+	const void* sys;
+	const char* name;
+	size_t capacity;
+	size_t high_water;
+	size_t dropped;
+} tg_probe_pool_t;
+
+/**
+ * Timing probes around the phases of each frame, recorded by tg_loop_run,
+ * tg_update_particle_sys and tg_screen_present. While disabled each probe
+ * costs a branch. Running with TG_PROBES set to a path in the environment
+ * enables them and has tg_probes_finish write a summary to that file.
+ */
+static struct {
+	int enabled;
+	int overlay;            // draw the stats over every presented frame
+	const char* dump_path;
+
+	tg_probe_t phase[TG_PHASE_COUNT];
+	size_t particles;       // particles alive after the last tick
+	size_t frame_bytes;     // bytes written by the last present
+	uint64_t total_bytes;
+	tg_probe_pool_t pools[TG_PROBE_SYSTEMS]; // usage of each particle system updated, for sizing them
+	int pool_count;
+
+	size_t _particles;      // particles counted by the current tick
+	double _flush;          // time spent presenting by the current frame
+	double _last_frame;     // start of the previous frame
+} tg_probes;
+
+static const char* _tg_phase_names[TG_PHASE_COUNT] = {
+	"input", "update", "particles", "sample", "flush", "frame",
+};
+
+/**
+ * @brief      Records the pool usage of a particle system, the first
+ *             TG_PROBE_SYSTEMS systems seen are kept.
+ *
+ * @param[in]  sys         The system, identifies it between calls
+ * @param[in]  name        The system's name, may be NULL
+ * @param[in]  capacity    The most particles the system can hold
+ * @param[in]  high_water  The most particles that were alive at once
+ * @param[in]  dropped     The spawns rejected because the system was full
+ */
+void tg_probe_pool(const void* sys, const char* name, size_t capacity, size_t high_water, size_t dropped)
+{
+	int i = 0;
+	while (i < tg_probes.pool_count && tg_probes.pools[i].sys != sys) { ++i; }
+
+	if (i == TG_PROBE_SYSTEMS) { return; }
+	if (i == tg_probes.pool_count) { tg_probes.pool_count++; }
+
+	tg_probes.pools[i] = (tg_probe_pool_t){ sys, name ? name : "particles", capacity, high_water, dropped };
+}
+
+/**
+ * @brief      Starts timing a phase.
+ *
+ * @return     The start time to pass to tg_probe_end, 0 if probes are
+ *             disabled.
+ */
+static inline double tg_probe_begin(void)
+{
+	return tg_probes.enabled ? tg_time_sec() : 0;
+}
+
+/**
+ * @brief      Records a duration for a phase.
+ *
+ * @param[in]  phase  The phase
+ * @param[in]  sec    The duration
+ */
+void tg_probe_record(tg_phase_t phase, double sec)
+{
+	tg_probe_t* probe = tg_probes.phase + phase;
+
+	probe->window[probe->count & (TG_PROBE_WINDOW - 1)] = sec;
+	probe->count++;
+	probe->total += sec;
+	if (sec > probe->max) { probe->max = sec; }
+}
+
+/**
+ * @brief      Stops timing a phase started with tg_probe_begin. Nothing is
+ *             recorded if the probes were disabled when it started.
+ *
+ * @param[in]  phase  The phase
+ * @param[in]  start  The time tg_probe_begin returned
+ */
+static inline void tg_probe_end(tg_phase_t phase, double start)
+{
+	if (tg_probes.enabled && start > 0) { tg_probe_record(phase, tg_time_sec() - start); }
+}
+
+static int _tg_probe_cmp(const void* a, const void* b)
+{
+	float x = *(const float*)a, y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief      Computes the statistics of a phase's recent durations.
+ *
+ * @param[in]  phase  The phase
+ *
+ * @return     The statistics, all 0 if nothing was recorded.
+ */
+tg_probe_stats_t tg_probe_stats(tg_phase_t phase)
+{
+	tg_probe_t const* probe = tg_probes.phase + phase;
+	tg_probe_stats_t stats = { .max = probe->max };
+	size_t n = probe->count < TG_PROBE_WINDOW ? probe->count : TG_PROBE_WINDOW;
+	float sorted[TG_PROBE_WINDOW];
+	double sum = 0;
+
+	if (!n) { return stats; }
+
+	memcpy(sorted, probe->window, n * sizeof(float));
+	qsort(sorted, n, sizeof(float), _tg_probe_cmp);
+	for (size_t i = n; i--;) { sum += sorted[i]; }
+
+	stats.min = sorted[0];
+	stats.avg = sum / n;
+	stats.p99 = sorted[(n * 99) / 100];
+
+	return stats;
+}
+
+/**
+ * @brief      Shows or hides the stats overlay. Probes are enabled while the
+ *             overlay is shown or a dump was requested.
+ */
+void tg_probes_toggle_overlay(void)
+{
+	tg_probes.overlay = !tg_probes.overlay;
+	tg_probes.enabled = tg_probes.overlay || tg_probes.dump_path;
+}
+
+/**
+ * @brief      Enables the probes if TG_PROBES is set in the environment.
+ *             Call once at start up.
+ */
+void tg_probes_config(void)
+{
+	tg_probes.dump_path = getenv("TG_PROBES");
+	if (tg_probes.dump_path && !*tg_probes.dump_path) { tg_probes.dump_path = NULL; }
+	tg_probes.enabled = tg_probes.overlay || tg_probes.dump_path;
+}
+
+/**
+ * @brief      Writes the statistics of every phase, one line per phase of
+ *             space separated key=value pairs, times in microseconds. Then
+ *             comes a line per particle system with its pool usage, and the
+ *             last line holds the bytes written to the terminal.
+ *
+ * @param      out   The file to write to
+ */
+void tg_probes_dump(FILE* out)
+{
+	for (int p = 0; p < TG_PHASE_COUNT; ++p)
+	{
+		tg_probe_t const* probe = tg_probes.phase + p;
+		tg_probe_stats_t stats = tg_probe_stats(p);
+
+		fprintf(out, "phase=%s count=%llu mean_us=%.1f max_us=%.1f min_us=%.1f avg_us=%.1f p99_us=%.1f\n",
+		        _tg_phase_names[p], (unsigned long long)probe->count,
+		        probe->count ? probe->total * 1e6 / probe->count : 0, probe->max * 1e6,
+		        stats.min * 1e6, stats.avg * 1e6, stats.p99 * 1e6);
+	}
+
+	for (int i = 0; i < tg_probes.pool_count; ++i)
+	{
+		tg_probe_pool_t const* pool = tg_probes.pools + i;
+
+		fprintf(out, "pool=%s capacity=%zu high_water=%zu dropped=%zu\n",
+		        pool->name, pool->capacity, pool->high_water, pool->dropped);
+	}
+
+	uint64_t frames = tg_probes.phase[TG_PHASE_FLUSH].count;
+	fprintf(out, "bytes=%llu bytes_per_frame=%.1f\n",
+	        (unsigned long long)tg_probes.total_bytes,
+	        frames ? (double)tg_probes.total_bytes / frames : 0);
+}
+
+/**
+ * @brief      Writes the dump requested through TG_PROBES, if any. Call once
+ *             the game is over.
+ *
+ * @return     0 on success, -1 if the dump couldn't be written
+ */
+int tg_probes_finish(void)
+{
+	if (!tg_probes.dump_path) { return 0; }
+
+	FILE* out = fopen(tg_probes.dump_path, "w");
+	if (!out) { return -1; }
+
+	tg_probes_dump(out);
+
+	return fclose(out);
+}
+
+/**
+ * Small pseudo random generator (splitmix64: a Weyl sequence run through a
+ * xorshift-multiply mix). Each particle system and game owns one, so streams
+ * don't interfere and a seed replays the same numbers. Every state, 0
+ * included, is valid.
+ */
+typedef struct {
+	uint64_t state;
+} tg_rng_t;
+
+#define _TG_RNG_STEP 0x9e3779b97f4a7c15ull
+
+static inline uint64_t _tg_rng_mix(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+/**
+ * @brief      Seeds a generator.
+ *
+ * @param      rng   The generator
+ * @param[in]  seed  The seed
+ */
+static inline void tg_rng_seed(tg_rng_t* rng, uint64_t seed)
+{
+	rng->state = seed;
+}
+
+/**
+ * @brief      Draws the next 64 random bits.
+ *
+ * @param      rng   The generator
+ *
+ * @return     The bits
+ */
+static inline uint64_t tg_rng_next(tg_rng_t* rng)
+{
+	return _tg_rng_mix(rng->state += _TG_RNG_STEP);
+}
+
+/**
+ * @brief      Draws a random integer below 'bound'.
+ *
+ * @param      rng    The generator
+ * @param[in]  bound  The bound, greater than 0
+ *
+ * @return     Random integer in the range [0, bound)
+ */
+static inline uint32_t tg_rng_below(tg_rng_t* rng, uint32_t bound)
+{
+	return ((tg_rng_next(rng) >> 32) * bound) >> 32;
+}
+
+/**
+ * @brief      Draws a random float.
+ *
+ * @param      rng   The generator
+ *
+ * @return     Random float in the range [-1, 1)
+ */
+static inline float tg_rng_float(tg_rng_t* rng)
+{
+	return (int32_t)(tg_rng_next(rng) >> 32) * 0x1p-31f;
+}
+
+/**
+ * @brief      Fills 'out' with random floats, the same ones tg_rng_float
+ *             would return one by one, scaled by 'scale'. Meant for drawing
+ *             the randomness of a whole burst of particles at once.
+ *
+ * @param      rng    The generator
+ * @param      out    The floats
+ * @param[in]  n      The number of floats
+ * @param[in]  scale  The floats are in the range [-scale, scale)
+ */
+void tg_rng_fill_floats(tg_rng_t* rng, float* out, size_t n, float scale)
+{
+	uint64_t state = rng->state;
+	scale *= 0x1p-31f;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		state += _TG_RNG_STEP;
+		out[i] = (int32_t)(_tg_rng_mix(state) >> 32) * scale;
+	}
+
+	rng->state = state;
+}
+
+/**
+ * @brief      Fills 'out' with random bytes.
+ *
+ * @param      rng   The generator
+ * @param      out   The bytes
+ * @param[in]  len   The number of bytes
+ */
+void tg_rng_fill_bytes(tg_rng_t* rng, void* out, size_t len)
+{
+	uint8_t* bytes = (uint8_t*)out;
+
+	for (; len >= 8; len -= 8, bytes += 8)
+	{
+		uint64_t r = tg_rng_next(rng);
+		memcpy(bytes, &r, 8);
+	}
+
+	if (len)
+	{
+		uint64_t r = tg_rng_next(rng);
+		memcpy(bytes, &r, len);
+	}
+}
+
+/**
+ * Generator used by tg_randf, seed it for repeatable runs.
+ */
+static tg_rng_t tg_default_rng;
+
+/**
+ * A single terminal cell packed into 32 bits. The low bits are the index of
+ * its glyph in the glyph palette, ASCII characters being their own index,
+ * followed by its attributes and its foreground and background colors. A
+ * color of TG_DEFAULT is the terminal's default, TG_COLOR(n) is color n of
+ * its 256. Two cells look the same exactly when they are equal, build them
+ * with TG_CELL.
+ */
+typedef uint32_t tg_cell_t;
+
+#define TG_CELL_GLYPHS 1024
+#define TG_CELL_GLYPH_MASK ((tg_cell_t)TG_CELL_GLYPHS - 1)
+#define TG_CELL_STYLE_MASK (~TG_CELL_GLYPH_MASK)
+#define _TG_CELL_ATTRS_SHIFT 10
+#define _TG_CELL_FG_SHIFT 14
+#define _TG_CELL_BG_SHIFT 23
+
+enum {
+	TG_ATTR_BOLD      = 1 << 0,
+	TG_ATTR_DIM       = 1 << 1,
+	TG_ATTR_UNDERLINE = 1 << 2,
+	TG_ATTR_REVERSE   = 1 << 3,
+};
+
+// colors 0 to 7 are black, red, green, yellow, blue, magenta, cyan and
+// white, 8 to 15 their bright versions
+#define TG_DEFAULT 0
+#define TG_COLOR(n) ((n) + 1)
+
+#define TG_CELL(glyph, fg, bg, attrs) ((tg_cell_t)(glyph) | \
+	(tg_cell_t)(attrs) << _TG_CELL_ATTRS_SHIFT | \
+	(tg_cell_t)(fg) << _TG_CELL_FG_SHIFT | \
+	(tg_cell_t)(bg) << _TG_CELL_BG_SHIFT)
+
+static inline int tg_cell_glyph(tg_cell_t cell) { return cell & TG_CELL_GLYPH_MASK; }
+static inline int tg_cell_attrs(tg_cell_t cell) { return (cell >> _TG_CELL_ATTRS_SHIFT) & 15; }
+static inline int tg_cell_fg(tg_cell_t cell) { return (cell >> _TG_CELL_FG_SHIFT) & 511; }
+static inline int tg_cell_bg(tg_cell_t cell) { return cell >> _TG_CELL_BG_SHIFT; }
+
 typedef struct {
 	struct { float x, y; } pos;
 	struct { float x, y; } vel;
@@ -21,318 +438,3236 @@ typedef struct {
 	char glyph;
 } tg_particle_t;
 
+/**
+ * Occupancy of a single terminal cell by the particles of a system. Cells are
+ * kept in a hash table keyed by row and col that is rebuilt every update so
+ * that sampling doesn't need to visit each particle.
+ */
+typedef struct {
+	int row, col;
+	uint16_t density; // number of particles in the cell, saturates, 0 for an empty slot
+	char glyph;       // glyph of the first particle in the cell that has one
+} tg_particle_cell_t;
+
+/**
+ * Linear allocator over a block of memory supplied by the caller. Allocations
+ * are never freed individually, the whole arena is reset or discarded at once.
+ */
+typedef struct {
+	uint8_t* base;
+	size_t size;
+	size_t used;
+} tg_arena_t;
+
+/**
+ * Storage layouts a particle system can use. AoS keeps each particle in a
+ * tg_particle_t, SoA keeps each field in its own array so that the integrate
+ * pass can be vectorized.
+ */
+typedef enum {
+	TG_PARTICLES_AOS = 0,
+	TG_PARTICLES_SOA,
+} tg_particle_layout_t;
+
+/**
+ * Particle fields stored as parallel arrays, used by TG_PARTICLES_SOA.
+ */
+typedef struct {
+	float *x, *y;
+	float *vx, *vy;
+	int* life;
+	char* glyph;
+} tg_particle_soa_t;
+
 typedef struct {
-	tg_particle_t particles[128];
+	tg_particle_t* particles;   // storage when layout is TG_PARTICLES_AOS
+	tg_particle_soa_t soa;      // storage when layout is TG_PARTICLES_SOA
+	tg_particle_layout_t layout;
+	const char* name;           // tells systems apart in the probes
 	int start_life;
 	float repulsion;
 	char density_glyphs[16];
+	tg_cell_t style;            // colors and attributes tg_screen_blit_particles draws with
+	tg_rng_t rng;               // for the system's spawning code, seed it for repeatable runs
+
+	struct {
+		size_t high_water; // most particles that were alive at once
+		size_t dropped;    // spawns rejected because the system was full
+	} stats;
+
+	size_t _glyph_count;
+	int _living_count;
+	size_t _capacity;
+
+	tg_particle_cell_t* _cells; // cell index, twice as many slots as bins
+	int* _occupied;             // slots of _cells in use, so clearing skips the empty ones
+	int _occupied_count;
+	size_t _bin_mask;           // bin count - 1, bins are a power of 2 >= capacity
+	int* _bin_start;            // repulsion scratch, see _tg_repel_particles
+	int* _scratch;
+	void* _owned;               // allocation made by init when no arena is given
+} tg_particle_system_t;
+
+/**
+ * @brief      Returns a random float drawn from tg_default_rng.
+ *
+ * @return     Random float in the range [-1, 1)
+ */
+float tg_randf() { return tg_rng_float(&tg_default_rng); }
+
+// capacity given to systems that are spawned into without being initialized
+#define TG_PARTICLES_DEFAULT 128
+
+/**
+ * @brief      Allocates 'size' bytes from the arena, aligned to 16 bytes.
+ *
+ * @param      arena  The arena
+ * @param[in]  size   The size in bytes
+ *
+ * @return     Pointer to the allocation, NULL if the arena is exhausted.
+ */
+void* tg_arena_alloc(tg_arena_t* arena, size_t size)
+{
+	size_t start = (arena->used + 15) & ~(size_t)15;
+
+	if (start > arena->size || size > arena->size - start) { return NULL; }
+
+	arena->used = start + size;
+	return arena->base + start;
+}
+
+static inline size_t _tg_pow2_ceil(size_t n)
+{
+	size_t p = 1;
+	while (p < n) { p <<= 1; }
+	return p;
+}
+
+/**
+ * @brief      Computes the number of arena bytes a particle system with the
+ *             given capacity needs.
+ *
+ * @param[in]  capacity  The maximum number of living particles
+ *
+ * @return     Size in bytes, including alignment padding.
+ */
+size_t tg_particle_sys_footprint(size_t capacity)
+{
+	size_t bins = _tg_pow2_ceil(capacity);
+	size_t aos = capacity * sizeof(tg_particle_t) + 15;
+	size_t soa = 4 * (capacity * sizeof(float) + 64 + 15) + (capacity * sizeof(int) + 64 + 15) + (capacity + 15);
+
+	return (aos > soa ? aos : soa) +
+	       (bins * 2 * sizeof(tg_particle_cell_t) + 15) +
+	       ((bins + 1) * sizeof(int) + 15) +
+	       (capacity * 5 * sizeof(int) + 15);
+}
+
+/**
+ * @brief      Sets the capacity of a particle system and allocates its
+ *             storage in the system's layout. Spawning never allocates, once
+ *             'capacity' particles are alive further spawns are dropped and
+ *             counted in the stats.
+ *
+ * @param      sys       The particle system.
+ * @param[in]  capacity  The maximum number of living particles
+ * @param      arena     Arena to allocate from, see tg_particle_sys_footprint.
+ *                       If NULL the storage is allocated from the heap.
+ *
+ * @return     0 on success, -1 if the storage could not be allocated
+ */
+int tg_particle_sys_init(tg_particle_system_t* sys, size_t capacity, tg_arena_t* arena)
+{
+	tg_arena_t heap = {};
+	size_t bins = _tg_pow2_ceil(capacity);
+
+	if (!arena)
+	{
+		heap.size = tg_particle_sys_footprint(capacity);
+		heap.base = (uint8_t*)malloc(heap.size);
+		if (!heap.base) { return -1; }
+		arena = &heap;
+	}
+
+	size_t used = arena->used;
+	tg_particle_t* particles = NULL;
+	tg_particle_soa_t soa = {};
+	int stored;
+
+	if (sys->layout == TG_PARTICLES_SOA)
+	{
+		// each array is padded by a cache line so that, for power of 2
+		// capacities, the streams don't all map to the same cache sets
+		const size_t pad = 64;
+		soa.x = (float*)tg_arena_alloc(arena, capacity * sizeof(float) + pad);
+		soa.y = (float*)tg_arena_alloc(arena, capacity * sizeof(float) + pad);
+		soa.vx = (float*)tg_arena_alloc(arena, capacity * sizeof(float) + pad);
+		soa.vy = (float*)tg_arena_alloc(arena, capacity * sizeof(float) + pad);
+		soa.life = (int*)tg_arena_alloc(arena, capacity * sizeof(int) + pad);
+		soa.glyph = (char*)tg_arena_alloc(arena, capacity);
+		stored = soa.x && soa.y && soa.vx && soa.vy && soa.life && soa.glyph;
+	}
+	else
+	{
+		particles = (tg_particle_t*)tg_arena_alloc(arena, capacity * sizeof(tg_particle_t));
+		stored = particles != NULL;
+	}
+
+	tg_particle_cell_t* cells = (tg_particle_cell_t*)tg_arena_alloc(arena, bins * 2 * sizeof(tg_particle_cell_t));
+	int* bin_start = (int*)tg_arena_alloc(arena, (bins + 1) * sizeof(int));
+	int* scratch = (int*)tg_arena_alloc(arena, capacity * 4 * sizeof(int));
+	int* occupied = (int*)tg_arena_alloc(arena, capacity * sizeof(int));
+
+	if (!stored || !cells || !bin_start || !scratch || !occupied)
+	{
+		arena->used = used;
+		free(heap.base);
+		return -1;
+	}
+
+	free(sys->_owned);
+
+	sys->particles = particles;
+	sys->soa = soa;
+	sys->_cells = cells;
+	sys->_occupied = occupied;
+	sys->_occupied_count = 0;
+	sys->_bin_mask = bins - 1;
+	sys->_bin_start = bin_start;
+	sys->_scratch = scratch;
+	sys->_capacity = capacity;
+	sys->_owned = heap.base;
+	sys->_living_count = 0;
+	memset(&sys->stats, 0, sizeof(sys->stats));
+	memset(cells, 0, bins * 2 * sizeof(tg_particle_cell_t));
+
+	return 0;
+}
+
+/**
+ * @brief      Releases storage allocated from the heap by
+ *             tg_particle_sys_init. Storage from an arena is left alone.
+ *
+ * @param      sys   The particle system.
+ */
+void tg_particle_sys_free(tg_particle_system_t* sys)
+{
+	free(sys->_owned);
+	sys->_owned = NULL;
+	sys->particles = NULL;
+	memset(&sys->soa, 0, sizeof(sys->soa));
+	sys->_cells = NULL;
+	sys->_occupied = NULL;
+	sys->_occupied_count = 0;
+	sys->_capacity = 0;
+	sys->_living_count = 0;
+}
+
+static inline size_t _tg_particle_cell_hash(int row, int col)
+{
+	return ((unsigned)row * 73856093u) ^ ((unsigned)col * 19349663u);
+}
+
+/**
+ * @brief      Finds the hash table slot of the cell at 'row', 'col'. If the
+ *             cell isn't occupied the empty slot it would occupy is returned.
+ *
+ * @param      sys   The particle system.
+ * @param[in]  row   The row
+ * @param[in]  col   The col
+ *
+ * @return     Pointer to the cell's slot.
+ */
+static inline tg_particle_cell_t* _tg_particle_cell_slot(tg_particle_system_t const* sys, int row, int col)
+{
+	const size_t mask = (sys->_bin_mask << 1) | 1;
+
+	for (size_t i = _tg_particle_cell_hash(row, col);; ++i)
+	{
+		tg_particle_cell_t* cell = sys->_cells + (i & mask);
+		if (cell->density == 0 || (cell->row == row && cell->col == col)) { return cell; }
+	}
+}
+
+static inline void _tg_particle_cell_add(tg_particle_system_t* sys, float x, float y, char glyph)
+{
+	int row = (int)y, col = (int)x;
+	tg_particle_cell_t* cell = _tg_particle_cell_slot(sys, row, col);
+
+	if (cell->density == 0)
+	{ // a cell per living particle at most, so this can't overflow
+		sys->_occupied[sys->_occupied_count++] = (int)(cell - sys->_cells);
+		cell->row = row;
+		cell->col = col;
+		cell->glyph = 0;
+	}
+
+	// saturate, wrapping to 0 would make the slot look empty
+	if (cell->density < UINT16_MAX) { cell->density++; }
+	if (cell->glyph == 0 && glyph > 0) { cell->glyph = glyph; }
+}
+
+/**
+ * @brief      Applies repulsion between particles closer than half a cell.
+ *             Particles are counting-sorted into hashed bins by the integer
+ *             cell they occupy, so only particles in the same or adjacent
+ *             cells are tested against each other.
+ *
+ * @param      sys   The particle system.
+ */
+static void _tg_repel_particles(tg_particle_system_t* sys)
+{
+	const int n = sys->_living_count;
+
+	// bins sized for the living particles rather than the capacity, so
+	// clearing and summing them costs no more than sorting the particles
+	const size_t mask = _tg_pow2_ceil(n) - 1;
+
+	// both layouts are walked as strided float arrays
+	size_t stride = 1;
+	float *px = sys->soa.x, *py = sys->soa.y, *vx = sys->soa.vx, *vy = sys->soa.vy;
+
+	if (sys->layout == TG_PARTICLES_AOS)
+	{
+		stride = sizeof(tg_particle_t) / sizeof(float);
+		px = &sys->particles->pos.x;
+		py = &sys->particles->pos.y;
+		vx = &sys->particles->vel.x;
+		vy = &sys->particles->vel.y;
+	}
+
+	int* bin_start = sys->_bin_start;
+	int* cell_x = sys->_scratch;
+	int* cell_y = cell_x + sys->_capacity;
+	int* bin = cell_y + sys->_capacity;
+	int* order = bin + sys->_capacity;
+
+	memset(bin_start, 0, (mask + 2) * sizeof(int));
+
+	for (int i = n; i--;)
+	{
+		cell_x[i] = (int)floorf(px[i * stride]);
+		cell_y[i] = (int)floorf(py[i * stride]);
+		bin[i] = _tg_particle_cell_hash(cell_y[i], cell_x[i]) & mask;
+		bin_start[bin[i]]++;
+	}
+
+	// running sum gives the end of each bin, scattering backwards leaves
+	// bin_start[b] at the start of bin b and bin_start[b + 1] at its end
+	for (size_t b = 1; b <= mask + 1; ++b) { bin_start[b] += bin_start[b - 1]; }
+	for (int i = n; i--;) { order[--bin_start[bin[i]]] = i; }
+
+	for (int i = n; i--;)
+	for (int d_r = -1; d_r <= 1; ++d_r)
+	for (int d_c = -1; d_c <= 1; ++d_c)
+	{
+		int row = cell_y[i] + d_r, col = cell_x[i] + d_c;
+		size_t b = _tg_particle_cell_hash(row, col) & mask;
+
+		for (int k = bin_start[b]; k < bin_start[b + 1]; ++k)
+		{
+			int j = order[k];
+
+			// bins are shared by cells whose hashes collide
+			if (j == i || cell_y[j] != row || cell_x[j] != col) { continue; }
+
+			float d_x = px[i * stride] - px[j * stride];
+			float d_y = py[i * stride] - py[j * stride];
+
+			if (d_x * d_x + d_y * d_y < 0.25f)
+			{
+				vx[i * stride] += (vx[j * stride] - vx[i * stride]) * sys->repulsion;
+				vy[i * stride] += (vy[j * stride] - vy[i * stride]) * sys->repulsion;
+			}
+		}
+	}
+}
+
+/**
+ * @brief      Moves a block of up to 64 particles by their velocities and ages
+ *             them by one tick. Written over plain arrays with no branches so
+ *             the compiler can vectorize it.
+ *
+ * @param      x     x positions
+ * @param      y     y positions
+ * @param[in]  vx    x velocities
+ * @param[in]  vy    y velocities
+ * @param      life  remaining lives
+ * @param[in]  n     The number of particles, at most 64
+ *
+ * @return     A mask with bit i set if particle i died.
+ */
+static uint64_t _tg_integrate_particles_soa(float* __restrict x, float* __restrict y,
+                                            const float* __restrict vx, const float* __restrict vy,
+                                            int* __restrict life, size_t n)
+{
+	uint64_t dead = 0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		x[i] += vx[i];
+		y[i] += vy[i];
+		life[i] -= 1;
+		dead |= (uint64_t)(life[i] < 0) << i;
+	}
+
+	return dead;
+}
+
+/**
+ * @brief      Removes the dead particles of one block by replacing each with
+ *             the last particle, so the cost is one copy per death.
+ *
+ * @param      soa    The particle arrays
+ * @param[in]  n      The number of particles
+ * @param[in]  first  Index of the block's first particle
+ * @param[in]  dead   The block's death mask
+ *
+ * @return     The number of surviving particles.
+ */
+static size_t _tg_compact_particles_soa(tg_particle_soa_t* soa, size_t n, size_t first, uint64_t dead)
+{
+	while (dead)
+	{ // highest death first, everything past it is alive already and so is the replacement
+		int bit = 63 - __builtin_clzll(dead);
+		size_t i = first + bit;
+		dead &= ~((uint64_t)1 << bit);
+
+		n--;
+		soa->x[i] = soa->x[n];
+		soa->y[i] = soa->y[n];
+		soa->vx[i] = soa->vx[n];
+		soa->vy[i] = soa->vy[n];
+		soa->life[i] = soa->life[n];
+		soa->glyph[i] = soa->glyph[n];
+	}
+
+	return n;
+}
+
+/**
+ * @brief      Moves and ages every particle, removing those whose life ran
+ *             out. This doesn't refresh the cell index.
+ *
+ * @param      sys   The particle system.
+ */
+static void _tg_integrate_particles(tg_particle_system_t* sys)
+{
+	tg_particle_t* parts = sys->particles;
+	tg_particle_soa_t* soa = &sys->soa;
+
+	if (sys->layout == TG_PARTICLES_SOA)
+	{
+		// particles that start the update without life are the ones removed,
+		// after aging that is any with a negative life. Blocks go from the
+		// back, so a block is untouched until it's integrated and the
+		// particles swapped into it are alive
+		size_t n = sys->_living_count;
+		for (size_t first = n & ~(size_t)63, end = n; end > 0; end = first, first -= 64)
+		{
+			uint64_t dead = _tg_integrate_particles_soa(soa->x + first, soa->y + first, soa->vx + first, soa->vy + first,
+			                                            soa->life + first, end - first);
+			if (dead) { n = _tg_compact_particles_soa(soa, n, first, dead); }
+		}
+		sys->_living_count = n;
+	}
+	else for (int i = sys->_living_count; i--;)
+	{
+		if (parts[i].life <= 0)
+		{
+			parts[i] = parts[sys->_living_count - 1];
+			sys->_living_count--;
+		}
+		else
+		{
+			parts[i].pos.x += parts[i].vel.x;
+			parts[i].pos.y += parts[i].vel.y;
+			parts[i].life--;
+		}
+	}
+}
+
+/**
+ * @brief      Empties the cell index. Only the slots that were filled are
+ *             cleared, so the cost follows the particles rather than the
+ *             capacity.
+ *
+ * @param      sys   The particle system.
+ */
+static void _tg_clear_particle_cells(tg_particle_system_t* sys)
+{
+	for (int i = sys->_occupied_count; i--;)
+	{
+		memset(sys->_cells + sys->_occupied[i], 0, sizeof(tg_particle_cell_t));
+	}
+	sys->_occupied_count = 0;
+}
+
+/**
+ * @brief      Rebuilds the cell index from the particles' positions so that
+ *             sampling is a single lookup per cell.
+ *
+ * @param      sys   The particle system.
+ */
+static void _tg_index_particles(tg_particle_system_t* sys)
+{
+	_tg_clear_particle_cells(sys);
+
+	if (sys->layout == TG_PARTICLES_SOA)
+	for (int i = 0; i < sys->_living_count; ++i)
+	{
+		_tg_particle_cell_add(sys, sys->soa.x[i], sys->soa.y[i], sys->soa.glyph[i]);
+	}
+	else for (int i = 0; i < sys->_living_count; ++i)
+	{
+		tg_particle_t const* p = sys->particles + i;
+		_tg_particle_cell_add(sys, p->pos.x, p->pos.y, p->glyph);
+	}
+}
+
+/**
+ * @brief      Applies repulsion, then moves and ages the particles, without
+ *             rebuilding the cell index. The index is left empty, so until
+ *             the next tg_update_particle_sys sampling only sees particles
+ *             spawned since. This is the part of an update that depends on
+ *             the layout.
+ *
+ * @param      sys   The particle system.
+ */
+void tg_move_particle_sys(tg_particle_system_t* sys)
+{
+	if (!sys->_capacity) { return; }
+
+	if (sys->repulsion > 0) { _tg_repel_particles(sys); }
+
+	_tg_integrate_particles(sys);
+	_tg_clear_particle_cells(sys);
+}
+
+/**
+ * @brief      Computes next particle system state (animates) from the previous
+ *             state.
+ *
+ * @param      sys   The particle system.
+ */
+void tg_update_particle_sys(tg_particle_system_t* sys)
+{
+	if (!sys->_capacity) { return; }
+
+	double start = tg_probe_begin();
+
+	tg_move_particle_sys(sys);
+	_tg_index_particles(sys);
+
+	tg_probe_end(TG_PHASE_PARTICLES, start);
+
+	if (tg_probes.enabled)
+	{
+		tg_probes._particles += sys->_living_count;
+		tg_probe_pool(sys, sys->name, sys->_capacity, sys->stats.high_water, sys->stats.dropped);
+	}
+}
+
+/**
+ * @brief      Returns the occupancy of the cell at 'row', 'col'.
+ *
+ * @param      sys   The particle system.
+ * @param[in]  row   The row of the cell.
+ * @param[in]  col   The col of the cell.
+ *
+ * @return     The cell's density and glyph, NULL if no particles are in it.
+ */
+tg_particle_cell_t const* tg_particle_sys_cell(tg_particle_system_t const* sys, int row, int col)
+{
+	if (!sys->_living_count) { return NULL; }
+
+	tg_particle_cell_t const* cell = _tg_particle_cell_slot(sys, row, col);
+	return cell->density ? cell : NULL;
+}
+
+static inline char _tg_particle_cell_glyph(tg_particle_system_t const* sys, tg_particle_cell_t const* cell)
+{
+	if (cell->glyph) { return cell->glyph; }
+
+	size_t density = cell->density;
+	density = density >= sizeof(sys->density_glyphs) ? sizeof(sys->density_glyphs) - 1 : density;
+
+	return sys->density_glyphs[density];
+}
+
+/**
+ * @brief      Passes the row and column of the character being rendered. If
+ *             particles exist in that location, a non 0 character will be
+ *             returned.
+ *
+ * @param      sys   The particle system.
+ * @param[in]  row   The row of the character the terminal is rendering.
+ * @param[in]  col   The col of the character the terminal is rendering.
+ *
+ * @return     character to be displayed if there are particles present, 0
+ *             otherwise.
+ */
+char tg_sample_particle_sys(tg_particle_system_t const* sys, int row, int col)
+{
+	tg_particle_cell_t const* cell = tg_particle_sys_cell(sys, row, col);
+
+	return cell ? _tg_particle_cell_glyph(sys, cell) : 0;
+}
+
+/**
+ * @brief      Spawns given particle in the particle system. Systems that
+ *             weren't initialized get TG_PARTICLES_DEFAULT slots from the heap
+ *             on their first spawn.
+ *
+ * @param      sys   The particle system.
+ * @param      p     Pointer to particle that will be spawned in the system.
+ */
+void tg_spawn_particle(tg_particle_system_t* sys, tg_particle_t* p)
+{
+	if (!sys->_capacity && tg_particle_sys_init(sys, TG_PARTICLES_DEFAULT, NULL)) { return; }
+
+	if ((size_t)sys->_living_count >= sys->_capacity)
+	{
+		sys->stats.dropped++;
+		return;
+	}
+
+	if (sys->layout == TG_PARTICLES_SOA)
+	{
+		int i = sys->_living_count;
+		sys->soa.x[i] = p->pos.x;
+		sys->soa.y[i] = p->pos.y;
+		sys->soa.vx[i] = p->vel.x;
+		sys->soa.vy[i] = p->vel.y;
+		sys->soa.life[i] = p->life;
+		sys->soa.glyph[i] = p->glyph;
+	}
+	else
+	{
+		sys->particles[sys->_living_count] = *p;
+	}
+
+	sys->_living_count++;
+
+	if ((size_t)sys->_living_count > sys->stats.high_water)
+	{
+		sys->stats.high_water = sys->_living_count;
+	}
+
+	_tg_particle_cell_add(sys, p->pos.x, p->pos.y, p->glyph);
+}
+
+/**
+ * @brief      Removes all living particles from the system.
+ *
+ * @param      sys   The particle system.
+ */
+void tg_clear_particles(tg_particle_system_t* sys)
+{
+	sys->_living_count = 0;
+
+	if (sys->_cells) { _tg_clear_particle_cells(sys); }
+}
+
+/**
+ * @brief      Sets the terminal up to render a game like yours!
+ *
+ * @param      old_settings  The old terminal settings. Keep these to restore
+ *                           the previous settings for your terminal.
+ *
+ * @return     0 on success
+ */
+int tg_game_settings(struct termios* old_settings)
+{
+	struct termios newt;
+
+	// disable echo from stdin
+	tcgetattr(STDIN_FILENO, old_settings);
+	newt = *old_settings;
+	newt.c_lflag &= ~ECHO;
+	newt.c_lflag &= ~ICANON;
+	tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+
+	// hide cursor
+	fputs("\033[?25l", stderr);
+
+	return 0;
+}
+
+/**
+ * @brief      Restores a previously saved terminal settings object.
+ *
+ * @param      old_settings  The old terminal settings.
+ *
+ * @return     0 on success
+ */
+int tg_restore_settings(struct termios* old_settings)
+{
+	tcsetattr(STDIN_FILENO, TCSANOW, old_settings);
+	fputs("\033[?25h", stderr);
+
+	return 0;
+}
+
+
+/**
+ * Capabilities of the terminal named by TERM, loaded from terminfo once.
+ */
+typedef struct {
+	int cols, rows; // size terminfo gives, used when the tty can't tell, -1 if unknown
+	int colors;     // colors the terminal supports, -1 if unknown
+	int rep;        // the terminal can repeat the last character (REP)
+	int _loaded;    // 1 once loaded, -1 if there was no entry to load
+} tg_terminfo_t;
+
+static tg_terminfo_t _tg_terminfo;
+static volatile sig_atomic_t _tg_term_resized;
+static volatile sig_atomic_t _tg_interrupted;
+
+/**
+ * @brief      Loads the terminal's capabilities from terminfo. Only the first
+ *             call does any work, call it at start up.
+ *
+ * @return     The capabilities, all -1 if TERM has no terminfo entry.
+ */
+tg_terminfo_t const* tg_term_load()
+{
+	if (_tg_terminfo._loaded) { return &_tg_terminfo; }
+
+	char buf[2048];
+	const char* term = getenv("TERM");
+
+	_tg_terminfo = (tg_terminfo_t){ -1, -1, -1, 0, -1 };
+
+	if (term && tgetent(buf, term) > 0)
+	{
+		_tg_terminfo.cols = tgetnum((char*)"co");
+		_tg_terminfo.rows = tgetnum((char*)"li");
+		_tg_terminfo.colors = tgetnum((char*)"Co");
+		_tg_terminfo.rep = tgetstr((char*)"rp", NULL) != NULL;
+		_tg_terminfo._loaded = 1;
+	}
+
+	return &_tg_terminfo;
+}
+
+// asks the tty the frames are written to for its size
+static int _tg_term_winsize(struct winsize* ws)
+{
+	const int fds[] = { STDERR_FILENO, STDOUT_FILENO, STDIN_FILENO };
+
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!ioctl(fds[i], TIOCGWINSZ, ws) && ws->ws_col > 0 && ws->ws_row > 0) { return 1; }
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Get the current width in columns of the terminal
+ *
+ * @return     width in columns, -1 if the value cannot be retrieved
+ */
+int tg_term_width()
+{
+	struct winsize ws;
+	if (_tg_term_winsize(&ws)) { return ws.ws_col; }
+
+	return tg_term_load()->cols;
+}
+
+/**
+ * @brief      Get the current height in rows of the terminal
+ *
+ * @return     height in rows, -1 if the value cannot be retrieved
+ */
+int tg_term_height()
+{
+	struct winsize ws;
+	if (_tg_term_winsize(&ws)) { return ws.ws_row; }
+
+	return tg_term_load()->rows;
+}
+
+static void _tg_term_winch(int sig)
+{
+	(void)sig;
+	_tg_term_resized = 1;
+}
+
+/**
+ * @brief      Installs a SIGWINCH handler that only notes that the terminal
+ *             was resized, see tg_term_resized.
+ *
+ * @return     0 on success, -1 if the handler could not be installed
+ */
+int tg_term_watch_resize()
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _tg_term_winch;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	return sigaction(SIGWINCH, &sa, NULL);
+}
+
+/**
+ * @brief      Tells if the terminal was resized since the last call. Call it
+ *             at a frame boundary, then read the new size and resize the
+ *             screen before drawing the next frame.
+ *
+ * @return     1 if the terminal was resized, 0 otherwise.
+ */
+int tg_term_resized()
+{
+	if (!_tg_term_resized) { return 0; }
+
+	_tg_term_resized = 0;
+	return 1;
+}
+
+static void _tg_interrupt(int sig)
+{
+	(void)sig;
+	_tg_interrupted = 1;
+}
+
+/**
+ * @brief      Installs a SIGINT handler that only notes the interrupt, see
+ *             tg_interrupted. tg_loop_run returns once it is noted, so the
+ *             game leaves through its normal exit path, where restoring the
+ *             terminal and closing files is safe.
+ *
+ * @return     0 on success, -1 if the handler could not be installed
+ */
+int tg_watch_interrupt()
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _tg_interrupt;
+	sigemptyset(&sa.sa_mask);
+
+	return sigaction(SIGINT, &sa, NULL);
+}
+
+/**
+ * @brief      Tells if the game was interrupted (ctrl-c).
+ *
+ * @return     1 if SIGINT was received since tg_watch_interrupt, 0 otherwise.
+ */
+int tg_interrupted()
+{
+	return _tg_interrupted;
+}
+
+/**
+ * @brief      Returns a key pressed withing TG_TIMEOUT microseconds
+ *
+ * @param      key   The key character pressed
+ *
+ * @return     1 if a key is pressed, 0 otherwise.
+ */
+int tg_key_get(char* key)
+{
+	fd_set fds;
+	struct timeval tv = { 0, TG_TIMEOUT };
+
+	FD_ZERO(&fds);
+	FD_SET(STDIN_FILENO, &fds);
+
+#ifdef __linux__
+	__fpurge(stdin);
+#elif defined(__APPLE__)
+	fpurge(stdin);
+#endif
+
+	switch(select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv))
+	{
+		case 0:  // timeout
+		case -1: // error
+			return 0;
+	}
+
+	usleep(tv.tv_usec); // wait the remaining timeout
+
+	return read(STDIN_FILENO, key, sizeof(char)) == sizeof(char);
+}
+
+// keys that arrive as escape sequences, everything else is its character
+enum {
+	TG_KEY_ESC = 27,
+	TG_KEY_UP = 256,
+	TG_KEY_DOWN,
+	TG_KEY_RIGHT,
+	TG_KEY_LEFT,
+};
+
+// number of events the input queue holds, must be a power of 2
+#define TG_INPUT_QUEUE 256
+
+/**
+ * A key press, stamped with tg_time_sec() when it was read.
+ */
+typedef struct {
+	int key;     // character pressed, or one of TG_KEY_*
+	double time; // when the key was read
+} tg_key_event_t;
+
+/**
+ * What a recording does to the game's input.
+ */
+typedef enum {
+	TG_RECORD_OFF = 0,
+	TG_RECORD_WRITE,  // keys taken from the input are logged to the file
+	TG_RECORD_REPLAY, // keys come from the file instead of the input
+} tg_record_mode_t;
+
+/**
+ * Recording of a session: the seed and screen size it started with and every
+ * key the game took from its input, stamped with the tick it was taken on.
+ * Replaying it through the fixed timestep loop runs the game through the same
+ * states, provided the game only draws randomness from the seed and measures
+ * time in ticks. Resizes aren't recorded.
+ *
+ * The file starts with the magic "TGR1", the rows and cols as 16 bit and the
+ * seed as 64 bit little endian integers. Each key follows as two LEB128
+ * varints, the ticks since the previous key and the key + 1. A key of 0 ends
+ * the recording on the tick the game stopped.
+ */
+typedef struct {
+	tg_record_mode_t mode;
+	int headless;       // replay without drawing to the terminal
+	uint64_t seed;
+	int rows, cols;
+	uint64_t tick;      // ticks run so far
+
+	FILE* _file;
+	uint64_t _last;     // tick of the last key written or read
+	int _next;          // next key to replay, -1 once the recording ended
+} tg_record_t;
+
+// rows and cols past this in a recording's header are taken as corruption
+#define TG_RECORD_MAX_SIZE 4096
+
+static void _tg_record_put_le(FILE* f, uint64_t v, int bytes)
+{
+	for (int i = 0; i < bytes; ++i, v >>= 8) { fputc(v & 0xff, f); }
+}
+
+static uint64_t _tg_record_get_le(FILE* f, int bytes)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < bytes; ++i) { v |= (uint64_t)(fgetc(f) & 0xff) << (i * 8); }
+	return v;
+}
+
+static void _tg_record_put_varint(FILE* f, uint64_t v)
+{
+	for (; v >= 0x80; v >>= 7) { fputc((v & 0x7f) | 0x80, f); }
+	fputc(v, f);
+}
+
+static int _tg_record_get_varint(FILE* f, uint64_t* v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int b = fgetc(f);
+		if (b == EOF) { return -1; }
+
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) { return 0; }
+	}
+
+	return -1;
+}
+
+// reads the next key of a replay, a truncated file ends it where it stops
+static void _tg_record_read(tg_record_t* rec)
+{
+	uint64_t delta, key;
+
+	if (_tg_record_get_varint(rec->_file, &delta) || _tg_record_get_varint(rec->_file, &key))
+	{
+		rec->_next = -1;
+		return;
+	}
+
+	rec->_last += delta;
+	rec->_next = (int)key - 1;
+}
+
+/**
+ * @brief      Starts recording or replaying as the environment asks.
+ *             TG_RECORD=<path> records the session to path, TG_REPLAY=<path>
+ *             replays the one in path and TG_REPLAY_HEADLESS=1 does so
+ *             without drawing. Once open 'seed', 'rows' and 'cols' hold the
+ *             values the game must start with: the ones given, or the
+ *             recorded ones when replaying.
+ *
+ * @param      rec   The recording
+ * @param[in]  seed  The seed the game would start with
+ * @param[in]  rows  The rows the game would start with
+ * @param[in]  cols  The cols the game would start with
+ *
+ * @return     0 on success, -1 if the file couldn't be opened or isn't a
+ *             recording, with errno set to EINVAL for a bad header.
+ */
+int tg_record_open(tg_record_t* rec, uint64_t seed, int rows, int cols)
+{
+	const char* replay = getenv("TG_REPLAY");
+	const char* record = getenv("TG_RECORD");
+	const char* headless = getenv("TG_REPLAY_HEADLESS");
+
+	*rec = (tg_record_t){ .seed = seed, .rows = rows, .cols = cols, ._next = -1 };
+
+	if (replay && *replay)
+	{
+		char magic[4];
+
+		if (!(rec->_file = fopen(replay, "rb"))) { return -1; }
+
+		int valid = fread(magic, 1, 4, rec->_file) == 4 && !memcmp(magic, "TGR1", 4);
+		rec->rows = _tg_record_get_le(rec->_file, 2);
+		rec->cols = _tg_record_get_le(rec->_file, 2);
+		rec->seed = _tg_record_get_le(rec->_file, 8);
+
+		// a truncated header hits the end of the file, and a size no
+		// terminal has means the file is corrupt
+		if (!valid || feof(rec->_file) ||
+		    rec->rows < 1 || rec->rows > TG_RECORD_MAX_SIZE ||
+		    rec->cols < 1 || rec->cols > TG_RECORD_MAX_SIZE)
+		{
+			fclose(rec->_file);
+			rec->_file = NULL;
+			rec->rows = rows;
+			rec->cols = cols;
+			rec->seed = seed;
+			errno = EINVAL;
+			return -1;
+		}
+
+		rec->mode = TG_RECORD_REPLAY;
+		rec->headless = headless && *headless == '1';
+		_tg_record_read(rec);
+	}
+	else if (record && *record)
+	{
+		if (!(rec->_file = fopen(record, "wb"))) { return -1; }
+
+		fwrite("TGR1", 1, 4, rec->_file);
+		_tg_record_put_le(rec->_file, rows, 2);
+		_tg_record_put_le(rec->_file, cols, 2);
+		_tg_record_put_le(rec->_file, seed, 8);
+		rec->mode = TG_RECORD_WRITE;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Logs a key the game took on the current tick.
+ *
+ * @param      rec   The recording
+ * @param[in]  key   The key
+ */
+void tg_record_key(tg_record_t* rec, int key)
+{
+	if (rec->mode != TG_RECORD_WRITE) { return; }
+
+	_tg_record_put_varint(rec->_file, rec->tick - rec->_last);
+	_tg_record_put_varint(rec->_file, (uint64_t)key + 1);
+	rec->_last = rec->tick;
+}
+
+/**
+ * @brief      Takes the next recorded key if it was taken on the current
+ *             tick.
+ *
+ * @param      rec   The recording
+ * @param      ev    The key, stamped with the time it was replayed
+ *
+ * @return     1 if a key was taken, 0 if there are no more this tick.
+ */
+int tg_record_next(tg_record_t* rec, tg_key_event_t* ev)
+{
+	if (rec->_next < 0 || rec->_last != rec->tick) { return 0; }
+
+	*ev = (tg_key_event_t){ rec->_next, tg_time_sec() };
+	_tg_record_read(rec);
+
+	return 1;
+}
+
+/**
+ * @brief      Tells if a replay has reached the tick its recording ended on.
+ *
+ * @param      rec   The recording
+ *
+ * @return     1 once the replay is over, 0 otherwise or if not replaying.
+ */
+int tg_record_done(tg_record_t const* rec)
+{
+	return rec->mode == TG_RECORD_REPLAY && rec->_next < 0 && rec->tick >= rec->_last;
+}
+
+/**
+ * @brief      Ends a recording on the current tick and closes its file.
+ *
+ * @param      rec   The recording
+ *
+ * @return     0 on success, -1 if the recording couldn't be written
+ */
+int tg_record_close(tg_record_t* rec)
+{
+	if (!rec->_file) { return 0; }
+
+	if (rec->mode == TG_RECORD_WRITE) { tg_record_key(rec, -1); }
+
+	int res = fclose(rec->_file);
+	rec->_file = NULL;
+	rec->mode = TG_RECORD_OFF;
+
+	return res;
+}
+
+/**
+ * Keyboard input read by a dedicated thread. Decoded key presses are pushed
+ * into a single producer, single consumer ring so the game can drain every
+ * key that arrived since its last tick without locking or sleeping.
+ */
+typedef struct {
+	tg_key_event_t events[TG_INPUT_QUEUE];
+	atomic_size_t head; // next slot the reader thread fills
+	atomic_size_t tail; // next slot the game takes
+	atomic_size_t dropped; // key presses lost because the queue was full
+	tg_record_t* record;   // recording the keys taken go to or come from, may be NULL
+
+	pthread_t _thread;
+	int _wake[2];       // pipe used to stop the reader thread
+	int _state;         // escape sequence decoder state
+	size_t _seq_len;
+} tg_input_t;
+
+static void _tg_input_push(tg_input_t* in, int key, double time)
+{
+	size_t head = atomic_load_explicit(&in->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&in->tail, memory_order_acquire);
+
+	if (head - tail >= TG_INPUT_QUEUE)
+	{
+		atomic_fetch_add_explicit(&in->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	in->events[head & (TG_INPUT_QUEUE - 1)] = (tg_key_event_t){ key, time };
+	atomic_store_explicit(&in->head, head + 1, memory_order_release);
+}
+
+// states of the escape sequence decoder
+enum { _TG_INPUT_TEXT, _TG_INPUT_ESCAPE, _TG_INPUT_SEQUENCE };
+
+static void _tg_input_decode(tg_input_t* in, unsigned char b, double time)
+{
+	switch (in->_state)
+	{
+		case _TG_INPUT_TEXT:
+			if (b == TG_KEY_ESC) { in->_state = _TG_INPUT_ESCAPE; }
+			else { _tg_input_push(in, b, time); }
+			break;
+		case _TG_INPUT_ESCAPE:
+			if (b == '[' || b == 'O')
+			{ // CSI or SS3, arrow keys come as either
+				in->_state = _TG_INPUT_SEQUENCE;
+				in->_seq_len = 0;
+				break;
+			}
+
+			// escape followed by a plain key
+			_tg_input_push(in, TG_KEY_ESC, time);
+			in->_state = _TG_INPUT_TEXT;
+			_tg_input_decode(in, b, time);
+			break;
+		case _TG_INPUT_SEQUENCE:
+			if (b < 0x40 || b > 0x7e)
+			{ // parameter bytes, give up on runaway sequences
+				if (++in->_seq_len > 16) { in->_state = _TG_INPUT_TEXT; }
+				break;
+			}
+
+			switch (b)
+			{
+				case 'A': _tg_input_push(in, TG_KEY_UP, time); break;
+				case 'B': _tg_input_push(in, TG_KEY_DOWN, time); break;
+				case 'C': _tg_input_push(in, TG_KEY_RIGHT, time); break;
+				case 'D': _tg_input_push(in, TG_KEY_LEFT, time); break;
+				default: break; // other sequences are ignored
+			}
+
+			in->_state = _TG_INPUT_TEXT;
+			break;
+	}
+}
+
+static void* _tg_input_thread(void* arg)
+{
+	tg_input_t* in = (tg_input_t*)arg;
+	int nfds = (STDIN_FILENO > in->_wake[0] ? STDIN_FILENO : in->_wake[0]) + 1;
+
+	for (;;)
+	{
+		fd_set fds;
+		// an escape with nothing after it is the escape key itself
+		struct timeval tv = { 0, 25000 };
+
+		FD_ZERO(&fds);
+		FD_SET(STDIN_FILENO, &fds);
+		FD_SET(in->_wake[0], &fds);
+
+		int ready = select(nfds, &fds, NULL, NULL, in->_state == _TG_INPUT_ESCAPE ? &tv : NULL);
+
+		if (ready < 0)
+		{
+			if (errno == EINTR) { continue; }
+			break;
+		}
+
+		if (ready == 0)
+		{
+			_tg_input_push(in, TG_KEY_ESC, tg_time_sec());
+			in->_state = _TG_INPUT_TEXT;
+			continue;
+		}
+
+		if (FD_ISSET(in->_wake[0], &fds)) { break; }
+
+		unsigned char buf[64];
+		ssize_t len = read(STDIN_FILENO, buf, sizeof(buf));
+
+		if (len < 0 && errno == EINTR) { continue; }
+		if (len <= 0) { break; } // stdin was closed
+
+		double now = tg_time_sec();
+		for (ssize_t i = 0; i < len; ++i) { _tg_input_decode(in, buf[i], now); }
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief      Starts reading keys from stdin on a dedicated thread. The
+ *             terminal should already be in the mode set by tg_game_settings.
+ *             Signals are left to the game's other threads.
+ *
+ * @param      in    The input
+ *
+ * @return     0 on success, -1 if the thread could not be started
+ */
+int tg_input_start(tg_input_t* in)
+{
+	sigset_t all, old;
+
+	if (pipe(in->_wake)) { return -1; }
+
+	in->_state = _TG_INPUT_TEXT;
+	atomic_store(&in->head, 0);
+	atomic_store(&in->tail, 0);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int err = pthread_create(&in->_thread, NULL, _tg_input_thread, in);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err)
+	{
+		close(in->_wake[0]);
+		close(in->_wake[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Stops the reader thread and waits for it to exit.
+ *
+ * @param      in    The input
+ */
+void tg_input_stop(tg_input_t* in)
+{
+	if (write(in->_wake[1], "", 1) == 1) { pthread_join(in->_thread, NULL); }
+
+	close(in->_wake[0]);
+	close(in->_wake[1]);
+}
+
+/**
+ * @brief      Queues a key press as if the reader thread had read it. Only
+ *             use this while the reader thread isn't running, the queue has a
+ *             single producer.
+ *
+ * @param      in    The input
+ * @param[in]  key   The character, or one of TG_KEY_*
+ */
+void tg_input_inject(tg_input_t* in, int key)
+{
+	_tg_input_push(in, key, tg_time_sec());
+}
+
+/**
+ * @brief      Takes the oldest key press from the queue. Never blocks, call
+ *             it until it returns 0 to handle every key that has arrived.
+ *             While a recording is replayed its keys are taken instead.
+ *
+ * @param      in    The input
+ * @param      ev    The event taken from the queue
+ *
+ * @return     1 if an event was taken, 0 if the queue is empty.
+ */
+int tg_input_next(tg_input_t* in, tg_key_event_t* ev)
+{
+	if (in->record && in->record->mode == TG_RECORD_REPLAY) { return tg_record_next(in->record, ev); }
+
+	size_t tail = atomic_load_explicit(&in->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&in->head, memory_order_acquire);
+
+	if (tail == head) { return 0; }
+
+	*ev = in->events[tail & (TG_INPUT_QUEUE - 1)];
+	atomic_store_explicit(&in->tail, tail + 1, memory_order_release);
+
+	if (in->record) { tg_record_key(in->record, ev->key); }
+
+	return 1;
+}
+
+/**
+ * Fixed timestep game loop. 'input' and 'update' run exactly 'tick_hz' times a
+ * second no matter how long rendering takes, falling behind is caught up by
+ * running several ticks in a row. 'render' runs at most 'render_hz' times a
+ * second and is told how far into the next tick it is, so that moving things
+ * can be drawn where they would be between ticks. While 'record' replays a
+ * recording the loop runs ticks back to back, rendering once after each.
+ */
+typedef struct {
+	int tick_hz;      // simulation ticks per second
+	int render_hz;    // maximum frames per second, 0 renders once per tick
+	int max_catch_up; // most ticks run back to back before time is dropped, 0 for 5
+
+	void (*input)(void);           // called before each update, may be NULL
+	void (*update)(void);          // advances the game by one tick
+	void (*render)(float alpha);   // alpha in [0, 1) is the fraction of the next tick elapsed
+	int  (*playing)(void);         // the loop ends when this returns 0, may be NULL
+	tg_record_t* record;           // recording whose ticks the loop counts, may be NULL
+
+	struct {
+		uint64_t ticks;    // updates run
+		uint64_t frames;   // frames rendered
+		uint64_t dropped;  // ticks skipped because updates fell too far behind
+		double tick_sec;   // time the last input and update took
+		double frame_sec;  // time the last render took
+	} stats;
+} tg_loop_t;
+
+static void _tg_sleep_sec(double sec)
+{
+	if (sec <= 0) { return; }
+
+	struct timespec ts = { (time_t)sec, (long)((sec - (time_t)sec) * 1e9) };
+	nanosleep(&ts, NULL); // a signal cutting this short just wakes the loop early
+}
+
+// runs one tick, returns 0 if the game stopped playing during it
+static int _tg_loop_tick(tg_loop_t* loop)
+{
+	double start = tg_time_sec();
+	if (loop->input) { loop->input(); }
+	double updating = tg_time_sec();
+	loop->update();
+	loop->stats.tick_sec = tg_time_sec() - start;
+	loop->stats.ticks++;
+
+	if (tg_probes.enabled)
+	{
+		tg_probe_record(TG_PHASE_INPUT, updating - start);
+		tg_probe_record(TG_PHASE_UPDATE, start + loop->stats.tick_sec - updating);
+		tg_probes.particles = tg_probes._particles;
+	}
+	tg_probes._particles = 0;
+
+	if (loop->record) { loop->record->tick++; }
+
+	return !loop->playing || loop->playing();
+}
+
+static void _tg_loop_frame(tg_loop_t* loop, float alpha, double now)
+{
+	tg_probes._flush = 0;
+	loop->render(alpha);
+	loop->stats.frame_sec = tg_time_sec() - now;
+	loop->stats.frames++;
+
+	if (tg_probes.enabled)
+	{ // whatever the frame didn't spend presenting went to drawing it
+		tg_probe_record(TG_PHASE_SAMPLE, loop->stats.frame_sec - tg_probes._flush);
+		if (tg_probes._last_frame > 0) { tg_probe_record(TG_PHASE_FRAME, now - tg_probes._last_frame); }
+		tg_probes._last_frame = now;
+	}
+}
+
+/**
+ * @brief      Runs the loop until its 'playing' callback returns 0. Between
+ *             ticks and frames the thread sleeps rather than spins. Replays
+ *             run as fast as possible until the recording ends.
+ *
+ * @param      loop  The loop
+ *
+ * @return     0 once the game stops playing, -1 if the loop is misconfigured
+ */
+int tg_loop_run(tg_loop_t* loop)
+{
+	if (loop->tick_hz <= 0 || !loop->update || !loop->render) { return -1; }
+
+	if (loop->record && loop->record->mode == TG_RECORD_REPLAY)
+	{
+		while (!tg_record_done(loop->record) && !tg_interrupted() && (!loop->playing || loop->playing()))
+		{
+			if (!_tg_loop_tick(loop)) { return 0; }
+			_tg_loop_frame(loop, 0, tg_time_sec());
+		}
+
+		return 0;
+	}
+
+	const double tick = 1.0 / loop->tick_hz;
+	const double frame = loop->render_hz > 0 ? 1.0 / loop->render_hz : tick;
+	const int max_catch_up = loop->max_catch_up > 0 ? loop->max_catch_up : 5;
+
+	double last = tg_time_sec(), lag = 0, next_frame = last;
+
+	while (!tg_interrupted() && (!loop->playing || loop->playing()))
+	{
+		double now = tg_time_sec();
+		lag += now - last;
+		last = now;
+
+		for (int ticks = 0; lag >= tick; ++ticks)
+		{
+			if (ticks == max_catch_up)
+			{ // too far behind to catch up, let the game slow down instead
+				uint64_t behind = lag / tick;
+				loop->stats.dropped += behind;
+				lag -= behind * tick;
+				break;
+			}
+
+			lag -= tick;
+			if (!_tg_loop_tick(loop)) { return 0; }
+		}
+
+		now = tg_time_sec();
+		if (now >= next_frame)
+		{
+			_tg_loop_frame(loop, lag / tick, now);
+
+			// keep to the frame rate's schedule unless a frame was missed
+			next_frame += frame;
+			if (next_frame < now) { next_frame = now + frame; }
+		}
+
+		double next_tick = last + tick - lag;
+		_tg_sleep_sec((next_tick < next_frame ? next_tick : next_frame) - tg_time_sec());
+	}
+
+	return 0;
+}
+
+/**
+ * Context for drawing a string in the game.
+ */
+typedef struct {
+	int row;         // row where the origin of the string should appear.
+	int col;         // col where the origin of the string should appear.
+	const char* fmt; // printf style format string
+	struct {
+		// centered indicates that the string will appear centered around the origin.
+		uint8_t centered : 1;
+	} mode;          // defines the mode of the format string's origin
+
+	char   _buf[1024];
+	size_t _len;
+} tg_str_t;
+
+/**
+ * @brief      Samples a string in the game.
+ *
+ * @param[in]  row        The row
+ * @param[in]  col        The col
+ * @param      ctx        The string context
+ * @param[in]  <unnamed>  variadic input to context's format string
+ *
+ * @return     { description_of_the_return_value }
+ */
+int tg_str(int row, int col, tg_str_t* ctx, ...)
+{
+	va_list ap;
+
+	va_start(ap, ctx);
+	vsnprintf(ctx->_buf, sizeof(ctx->_buf), ctx->fmt, ap);
+	va_end(ap);
+
+	ctx->_len = strlen(ctx->_buf);
+
+	if (row != ctx->row) { return -1; }
+
+	int adj_col = ctx->col;
+	if (ctx->mode.centered) { adj_col -= ctx->_len >> 1; }
+	if (col >= adj_col && col < adj_col + (int)ctx->_len)
+	{
+		int i = col - adj_col;
+		return ctx->_buf[i];
+	}
+
+	return -1;
+}
+
+/**
+ * Growable byte buffer used to assemble an entire frame, escape sequences
+ * included, so that it can be handed to the terminal with a single write.
+ * The allocation is kept between frames and only grows.
+ */
+typedef struct {
+	char*  buf;
+	size_t len;
+	size_t cap;
+} tg_fb_t;
+
+/**
+ * @brief      Ensures the frame buffer can hold 'extra' more bytes without
+ *             reallocating.
+ *
+ * @param      fb     The frame buffer
+ * @param[in]  extra  The number of bytes that will be appended
+ *
+ * @return     0 on success, -1 if the buffer could not be grown
+ */
+int tg_fb_reserve(tg_fb_t* fb, size_t extra)
+{
+	if (fb->len + extra <= fb->cap) { return 0; }
+
+	size_t cap = fb->cap ? fb->cap : 4096;
+	while (cap < fb->len + extra) { cap <<= 1; }
+
+	char* buf = (char*)realloc(fb->buf, cap);
+	if (!buf) { return -1; }
+
+	fb->buf = buf;
+	fb->cap = cap;
+
+	return 0;
+}
+
+/**
+ * @brief      Appends 'len' bytes of 'str' to the frame buffer.
+ *
+ * @param      fb    The frame buffer
+ * @param[in]  str   The bytes to append
+ * @param[in]  len   The number of bytes to append
+ */
+void tg_fb_put(tg_fb_t* fb, const char* str, size_t len)
+{
+	if (tg_fb_reserve(fb, len)) { return; }
+
+	memcpy(fb->buf + fb->len, str, len);
+	fb->len += len;
+}
+
+/**
+ * @brief      Appends a null terminated string to the frame buffer.
+ *
+ * @param      fb    The frame buffer
+ * @param[in]  str   The string to append
+ */
+void tg_fb_puts(tg_fb_t* fb, const char* str)
+{
+	tg_fb_put(fb, str, strlen(str));
+}
+
+/**
+ * @brief      Appends a single character to the frame buffer.
+ *
+ * @param      fb    The frame buffer
+ * @param[in]  c     The character to append
+ */
+void tg_fb_putc(tg_fb_t* fb, char c)
+{
+	if (fb->len < fb->cap || !tg_fb_reserve(fb, 1)) { fb->buf[fb->len++] = c; }
+}
+
+/**
+ * @brief      Writes the contents of the frame buffer to 'fd' and empties it.
+ *             Partial writes and interruptions by signals (SIGWINCH for
+ *             instance) are retried so that the frame arrives whole.
+ *
+ * @param      fb    The frame buffer
+ * @param[in]  fd    The file descriptor to write to
+ *
+ * @return     0 on success, -1 on a write error
+ */
+int tg_fb_flush(tg_fb_t* fb, int fd)
+{
+	size_t off = 0;
+
+	while (off < fb->len)
+	{
+		ssize_t n = write(fd, fb->buf + off, fb->len - off);
+
+		if (n < 0)
+		{
+			if (errno == EINTR) { continue; }
+			fb->len = 0;
+			return -1;
+		}
+
+		off += n;
+	}
+
+	fb->len = 0;
+
+	return 0;
+}
+
+/**
+ * @brief      Releases the memory held by the frame buffer.
+ *
+ * @param      fb    The frame buffer
+ */
+void tg_fb_free(tg_fb_t* fb)
+{
+	free(fb->buf);
+	fb->buf = NULL;
+	fb->len = fb->cap = 0;
+}
+
+/**
+ * Persistent worker threads that split a job into bands. The calling thread
+ * works on the bands too, so a pool without workers just runs the job in
+ * place.
+ */
+typedef struct {
+	int threads; // worker threads, not counting the caller
+
+	pthread_t* _workers;
+	pthread_mutex_t _lock;
+	pthread_cond_t _wake;   // signaled when a job is posted or the pool stops
+	pthread_cond_t _idle;   // signaled when the last worker finished a job
+	uint64_t _generation;   // bumped for every job posted
+	int _running;           // workers that haven't finished the current job
+	int _quit;
+
+	void (*_job)(void* ctx, int band);
+	void* _ctx;
+	int _bands;
+	atomic_int _next;       // next band to be taken
+
+	tg_fb_t* _fbs;          // a frame buffer per band, see tg_rasterize_pool
+	int _fb_count;
+} tg_pool_t;
+
+static void _tg_pool_work(tg_pool_t* pool)
+{
+	for (int band; (band = atomic_fetch_add(&pool->_next, 1)) < pool->_bands;)
+	{
+		pool->_job(pool->_ctx, band);
+	}
+}
+
+static void* _tg_pool_worker(void* arg)
+{
+	tg_pool_t* pool = (tg_pool_t*)arg;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock(&pool->_lock);
+
+	for (;;)
+	{
+		while (!pool->_quit && pool->_generation == seen) { pthread_cond_wait(&pool->_wake, &pool->_lock); }
+		if (pool->_quit) { break; }
+
+		seen = pool->_generation;
+		pthread_mutex_unlock(&pool->_lock);
+
+		_tg_pool_work(pool);
+
+		pthread_mutex_lock(&pool->_lock);
+		if (--pool->_running == 0) { pthread_cond_signal(&pool->_idle); }
+	}
+
+	pthread_mutex_unlock(&pool->_lock);
+
+	return NULL;
+}
+
+/**
+ * @brief      Starts the pool's worker threads. Signals are left to the
+ *             game's other threads.
+ *
+ * @param      pool     The pool
+ * @param[in]  threads  Threads working on each job, the caller included. 0
+ *                      reads TG_THREADS from the environment, falling back
+ *                      to the number of online CPUs.
+ *
+ * @return     0 on success, -1 if the workers could not be started
+ */
+int tg_pool_start(tg_pool_t* pool, int threads)
+{
+	sigset_t all, old;
+
+	memset(pool, 0, sizeof(tg_pool_t));
+
+	if (threads <= 0 && getenv("TG_THREADS")) { threads = atoi(getenv("TG_THREADS")); }
+	if (threads <= 0) { threads = sysconf(_SC_NPROCESSORS_ONLN); }
+	if (threads <= 1) { return 0; }
+
+	pool->_workers = (pthread_t*)calloc(threads - 1, sizeof(pthread_t));
+	if (!pool->_workers) { return -1; }
+
+	pthread_mutex_init(&pool->_lock, NULL);
+	pthread_cond_init(&pool->_wake, NULL);
+	pthread_cond_init(&pool->_idle, NULL);
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	for (; pool->threads < threads - 1; pool->threads++)
+	{
+		if (pthread_create(pool->_workers + pool->threads, NULL, _tg_pool_worker, pool)) { break; }
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return 0;
+}
+
+/**
+ * @brief      Runs 'job' once for every band, spread over the workers and the
+ *             calling thread, and waits for all of them to finish.
+ *
+ * @param      pool   The pool
+ * @param[in]  bands  The number of bands
+ * @param      job    Called with 'ctx' and a band in [0, bands)
+ * @param      ctx    The job's context
+ */
+void tg_pool_run(tg_pool_t* pool, int bands, void (*job)(void* ctx, int band), void* ctx)
+{
+	if (!pool->threads)
+	{
+		for (int band = 0; band < bands; ++band) { job(ctx, band); }
+		return;
+	}
+
+	pthread_mutex_lock(&pool->_lock);
+	pool->_job = job;
+	pool->_ctx = ctx;
+	pool->_bands = bands;
+	atomic_store(&pool->_next, 0);
+	pool->_running = pool->threads;
+	pool->_generation++;
+	pthread_cond_broadcast(&pool->_wake);
+	pthread_mutex_unlock(&pool->_lock);
+
+	_tg_pool_work(pool);
+
+	pthread_mutex_lock(&pool->_lock);
+	while (pool->_running) { pthread_cond_wait(&pool->_idle, &pool->_lock); }
+	pthread_mutex_unlock(&pool->_lock);
+}
+
+/**
+ * @brief      Stops the workers and releases the pool's memory.
+ *
+ * @param      pool  The pool
+ */
+void tg_pool_stop(tg_pool_t* pool)
+{
+	if (pool->threads)
+	{
+		pthread_mutex_lock(&pool->_lock);
+		pool->_quit = 1;
+		pthread_cond_broadcast(&pool->_wake);
+		pthread_mutex_unlock(&pool->_lock);
+
+		for (int i = pool->threads; i--;) { pthread_join(pool->_workers[i], NULL); }
+
+		pthread_mutex_destroy(&pool->_lock);
+		pthread_cond_destroy(&pool->_wake);
+		pthread_cond_destroy(&pool->_idle);
+	}
+
+	for (int i = pool->_fb_count; i--;) { tg_fb_free(pool->_fbs + i); }
+	free(pool->_fbs);
+	free(pool->_workers);
+	memset(pool, 0, sizeof(tg_pool_t));
+}
+
+// bands a frame of 'rows' is split into, a few per thread to even out the load
+static inline int _tg_pool_bands(tg_pool_t const* pool, int rows)
+{
+	int bands = (pool->threads + 1) * 4;
+	return bands < rows ? bands : (rows > 0 ? rows : 1);
+}
+
+// frame shared by tg_clear and tg_rasterize
+static tg_fb_t _tg_frame;
+
+/**
+ * @brief      Erases the last 'rows' number of lines from the terminal
+ * and moves the cursor back up that same number of rows. This is intended
+ * to get ready for drawing a new frame. The escape sequence is queued and
+ * sent along with the next frame drawn by tg_rasterize.
+ *
+ * @param[in]  rows  The rows to clear
+ */
+void tg_clear(int rows)
+{
+	char move_up[16];
+	int len = snprintf(move_up, sizeof(move_up), "\033[%dA", rows);
+	tg_fb_put(&_tg_frame, move_up, len);
+}
+
+// appends rows 'first' up to 'end' of the frame to 'fb', a line per row
+static void _tg_rasterize_rows(tg_fb_t* fb, int first, int end, int cols, const char* (*sampler)(int row, int col))
+{
+	// most cells are a single byte, reserve for that up front
+	tg_fb_reserve(fb, (size_t)(end - first) * (cols + 1));
+
+	for (int r = first; r < end; ++r)
+	{
+		for (int c = 0; c < cols; ++c)
+		{
+			const char* glyph = sampler(r, c);
+
+			if (glyph[0] != '\0' && glyph[1] == '\0') { tg_fb_putc(fb, glyph[0]); }
+			else { tg_fb_puts(fb, glyph); }
+		} tg_fb_putc(fb, '\n');
+	}
+}
+
+/**
+ * @brief      Samples each row-col pair, exactly like tg_rasterize, but
+ * appends the result to 'fb' instead of writing it to the terminal.
+ *
+ * @param      fb       The frame buffer the frame is appended to
+ * @param[in]  rows     The number of rows that will be sampled
+ * @param[in]  cols     The number of cols that will be sampled
+ * @param      sampler  The sampler function pointer
+ */
+void tg_rasterize_fb(tg_fb_t* fb, int rows, int cols, const char* (*sampler)(int row, int col))
+{
+	_tg_rasterize_rows(fb, 0, rows, cols, sampler);
+}
+
+/**
+ * @brief      tg_rasterize simply iterates over each row and column from 0 to
+ * 'rows' and 0 to 'cols' for each row-col pair. With each pair, the `sampler`
+ * function pointer is called. This function pointer is user provided. And allows
+ * the programmer's game to dictate what should be displayed in each row-col pair
+ * by returning a pointer to the appropriate character. The whole frame is
+ * assembled in memory and written to stderr with a single write.
+ *
+ * @param[in]  rows     The number of rows that will be sampled
+ * @param[in]  cols     The number of cols that will be sampled
+ * @param      sampler  The sampler function pointer, whose purpose is described
+ *                      above
+ */
+void tg_rasterize(int rows, int cols, const char* (*sampler)(int row, int col))
+{
+	tg_rasterize_fb(&_tg_frame, rows, cols, sampler);
+	tg_fb_flush(&_tg_frame, STDERR_FILENO);
+}
+
+typedef struct {
+	tg_pool_t* pool;
+	int rows, cols, bands;
+	const char* (*sampler)(int row, int col);
+} _tg_rasterize_job_t;
+
+static void _tg_rasterize_band(void* ctx, int band)
+{
+	_tg_rasterize_job_t const* job = (_tg_rasterize_job_t const*)ctx;
+	tg_fb_t* fb = job->pool->_fbs + band;
+
+	fb->len = 0;
+	_tg_rasterize_rows(fb, band * job->rows / job->bands, (band + 1) * job->rows / job->bands, job->cols, job->sampler);
+}
+
+/**
+ * @brief      Same as tg_rasterize, but the rows are split into bands that
+ *             are sampled in parallel by the pool's threads. Each band is
+ *             written into its own buffer and the bands are joined in order
+ *             into the frame. The sampler must be thread-safe, use
+ *             tg_rasterize for those that aren't.
+ *
+ * @param      pool     The pool
+ * @param[in]  rows     The number of rows that will be sampled
+ * @param[in]  cols     The number of cols that will be sampled
+ * @param      sampler  The sampler function pointer, see tg_rasterize
+ *
+ * @return     0 on success, -1 on failure
+ */
+int tg_rasterize_pool(tg_pool_t* pool, int rows, int cols, const char* (*sampler)(int row, int col))
+{
+	_tg_rasterize_job_t job = { pool, rows, cols, _tg_pool_bands(pool, rows), sampler };
+
+	if (pool->_fb_count < job.bands)
+	{
+		tg_fb_t* fbs = (tg_fb_t*)realloc(pool->_fbs, job.bands * sizeof(tg_fb_t));
+		if (!fbs) { return -1; }
+
+		memset(fbs + pool->_fb_count, 0, (job.bands - pool->_fb_count) * sizeof(tg_fb_t));
+		pool->_fbs = fbs;
+		pool->_fb_count = job.bands;
+	}
+
+	tg_pool_run(pool, job.bands, _tg_rasterize_band, &job);
+
+	for (int b = 0; b < job.bands; ++b) { tg_fb_put(&_tg_frame, pool->_fbs[b].buf, pool->_fbs[b].len); }
+
+	return tg_fb_flush(&_tg_frame, STDERR_FILENO);
+}
+
+/**
+ * Glyphs other than single ASCII characters, UTF-8 sequences for instance,
+ * are interned here so that cells can refer to them by index.
+ */
+static struct {
+	char bytes[TG_CELL_GLYPHS][8];
+	int count;
+	pthread_mutex_t lock;
+} tg_glyphs = { .count = 128, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief      Returns the palette index of a glyph, adding the glyph to the
+ *             palette the first time it is seen. Interning is thread-safe,
+ *             but interning a game's glyphs once up front and keeping their
+ *             indices is cheaper than doing it per cell.
+ *
+ * @param[in]  glyph  The glyph's bytes
+ * @param[in]  len    The number of bytes, at most 7 are kept
+ *
+ * @return     The glyph's index, '?' once the palette is full.
+ */
+int tg_glyph_intern(const char* glyph, size_t len)
+{
+	if (len == 0) { return ' '; }
+	if (len == 1 && (unsigned char)glyph[0] < 128) { return glyph[0]; }
+	if (len > 7) { len = 7; }
+
+	int index = '?';
+
+	pthread_mutex_lock(&tg_glyphs.lock);
+	for (int i = 128; i < tg_glyphs.count; ++i)
+	{
+		if (!memcmp(tg_glyphs.bytes[i], glyph, len) && tg_glyphs.bytes[i][len] == '\0')
+		{
+			index = i;
+			break;
+		}
+	}
+
+	if (index == '?' && tg_glyphs.count < TG_CELL_GLYPHS)
+	{
+		index = tg_glyphs.count;
+		memcpy(tg_glyphs.bytes[index], glyph, len);
+		tg_glyphs.bytes[index][len] = '\0';
+		tg_glyphs.count++;
+	}
+	pthread_mutex_unlock(&tg_glyphs.lock);
+
+	return index;
+}
+
+// applies the parameters of an SGR sequence to a cell's style
+static tg_cell_t _tg_cell_sgr(tg_cell_t style, const char* params, const char* end)
+{
+	int p[16], n = 0;
+
+	while (params <= end && n < 16)
+	{
+		p[n++] = atoi(params);
+		while (params < end && *params != ';') { params++; }
+		params++;
+	}
+
+	int attrs = tg_cell_attrs(style), fg = tg_cell_fg(style), bg = tg_cell_bg(style);
+
+	for (int i = 0; i < n; ++i)
+	{
+		int v = p[i];
+
+		if (v == 0) { attrs = fg = bg = TG_DEFAULT; }
+		else if (v == 1) { attrs |= TG_ATTR_BOLD; }
+		else if (v == 2) { attrs |= TG_ATTR_DIM; }
+		else if (v == 4) { attrs |= TG_ATTR_UNDERLINE; }
+		else if (v == 7) { attrs |= TG_ATTR_REVERSE; }
+		else if (v == 22) { attrs &= ~(TG_ATTR_BOLD | TG_ATTR_DIM); }
+		else if (v == 24) { attrs &= ~TG_ATTR_UNDERLINE; }
+		else if (v == 27) { attrs &= ~TG_ATTR_REVERSE; }
+		else if (v >= 30 && v <= 37) { fg = TG_COLOR(v - 30); }
+		else if (v >= 90 && v <= 97) { fg = TG_COLOR(v - 90 + 8); }
+		else if (v == 39) { fg = TG_DEFAULT; }
+		else if (v >= 40 && v <= 47) { bg = TG_COLOR(v - 40); }
+		else if (v >= 100 && v <= 107) { bg = TG_COLOR(v - 100 + 8); }
+		else if (v == 49) { bg = TG_DEFAULT; }
+		else if ((v == 38 || v == 48) && i + 2 < n && p[i + 1] == 5)
+		{ // 256 colors, true colors (38;2;r;g;b) are skipped below
+			int color = TG_COLOR(p[i + 2] & 255);
+			if (v == 38) { fg = color; } else { bg = color; }
+			i += 2;
+		}
+		else if ((v == 38 || v == 48) && i + 1 < n && p[i + 1] == 2) { i += 4; }
+	}
+
+	return TG_CELL(0, fg, bg, attrs);
+}
+
+/**
+ * @brief      Parses a string as returned by a sampler into a cell. Leading
+ *             SGR escape sequences become the cell's style, trailing ones
+ *             (usually a reset) are dropped along with any other control
+ *             sequence. Glyphs that aren't a single ASCII character are
+ *             interned, see tg_glyph_intern.
+ *
+ * @param      cell  The cell to fill
+ * @param[in]  str   The sampled string
+ */
+void tg_cell_parse(tg_cell_t* cell, const char* str)
+{
+	char glyph[8];
+	size_t g = 0;
+	tg_cell_t style = 0;
+
+	while (*str)
+	{
+		if (str[0] == '\033' && str[1] == '[')
+		{
+			const char* params = str + 2;
+			const char* end = params;
+
+			while (*end && (*end < 0x40 || *end > 0x7e)) { end++; }
+
+			if (*end == 'm' && g == 0) { style = _tg_cell_sgr(style, params, end); }
+
+			str = *end ? end + 1 : end;
+			continue;
+		}
+
+		if ((unsigned char)*str >= ' ' && g < sizeof(glyph) - 1) { glyph[g++] = *str; }
+		str++;
+	}
+
+	*cell = style | tg_glyph_intern(glyph, g);
+}
+
+/**
+ * Double buffered screen. Frames are composed into 'back', then compared
+ * against 'front' (what the terminal is showing) so that only the cells that
+ * changed are sent to the terminal.
+ */
+typedef struct {
+	int rows, cols;
+	tg_cell_t* front;
+	tg_cell_t* back;
+	tg_fb_t fb;
+	int headless;            // frames are composed and diffed but never written
+	int alternate;           // frames go to the alternate screen, see tg_screen_open
+	int sync;                // frames are wrapped in synchronized updates (mode 2026)
+	int rep;                 // runs of a character are sent as one and a repeat (REP)
+	tg_pool_t* pool;         // threads sampling is split over, leave NULL for samplers that aren't thread-safe
+
+	size_t last_frame_bytes; // bytes written to the terminal by the last present
+	double last_present_sec; // time the last present took
+
+	int _painted;            // front holds a frame that is on the terminal
+	int _scroll;             // columns the frame was scrolled left by, see tg_screen_scroll
+	int _cur_row, _cur_col;  // cursor position relative to the frame, -1 if unknown
+	tg_cell_t _sgr;          // style the terminal is currently using
+} tg_screen_t;
+
+/**
+ * @brief      Sets the size of the screen, (re)allocating the cell grids if
+ *             the size changed. A resize forces the next frame to be
+ *             repainted completely.
+ *
+ * @param      scr   The screen
+ * @param[in]  rows  The rows
+ * @param[in]  cols  The cols
+ *
+ * @return     0 on success, -1 if the cell grids could not be allocated
+ */
+int tg_screen_resize(tg_screen_t* scr, int rows, int cols)
+{
+	if (scr->front && rows == scr->rows && cols == scr->cols) { return 0; }
+
+	// both grids are allocated before either is replaced, so a failure
+	// leaves the screen as it was. Neither grid's contents survive a resize
+	size_t count = (size_t)rows * cols;
+	tg_cell_t* front = (tg_cell_t*)malloc(count * sizeof(tg_cell_t));
+	tg_cell_t* back = (tg_cell_t*)malloc(count * sizeof(tg_cell_t));
+
+	if (!front || !back)
+	{
+		free(front);
+		free(back);
+		return -1;
+	}
+
+	if (scr->_painted && scr->alternate) { tg_fb_puts(&scr->fb, "\033[H\033[J"); }
+	else if (scr->_painted)
+	{ // return to the origin of the old frame and erase it
+		char seq[24];
+		int len = snprintf(seq, sizeof(seq), "\r\033[%dA\033[J", scr->rows);
+		tg_fb_put(&scr->fb, seq, len);
+	}
+
+	free(scr->front);
+	free(scr->back);
+	scr->front = front;
+	scr->back = back;
+	scr->rows = rows;
+	scr->cols = cols;
+	scr->_painted = 0;
+	scr->_scroll = 0;
+
+	return 0;
+}
+
+/**
+ * @brief      Tells the screen that the frame being composed is the last one
+ *             scrolled left by 'n' columns. When presenting, rows that are
+ *             cheaper to shift on the terminal than to redraw are shifted
+ *             with DCH (delete character) and only the cells the shift
+ *             didn't account for are drawn, usually the new column on the
+ *             right. Call once per frame, before tg_screen_present.
+ *
+ * @param      scr   The screen
+ * @param[in]  n     The columns the content moved left by
+ */
+void tg_screen_scroll(tg_screen_t* scr, int n)
+{
+	if (n > 0) { scr->_scroll += n; }
+}
+
+/**
+ * @brief      Returns the cell at 'row', 'col' of the frame being composed.
+ *
+ * @param      scr   The screen
+ * @param[in]  row   The row
+ * @param[in]  col   The col
+ *
+ * @return     Pointer to the back buffer's cell
+ */
+static inline tg_cell_t* tg_screen_cell(tg_screen_t* scr, int row, int col)
+{
+	return scr->back + (row * scr->cols) + col;
+}
+
+typedef struct {
+	tg_screen_t* scr;
+	int bands;
+	const char* (*sampler)(int row, int col);
+} _tg_screen_sample_job_t;
+
+static void _tg_screen_sample_band(void* ctx, int band)
+{
+	_tg_screen_sample_job_t const* job = (_tg_screen_sample_job_t const*)ctx;
+	tg_screen_t* scr = job->scr;
+	int end = (band + 1) * scr->rows / job->bands;
+	int r = band * scr->rows / job->bands;
+	tg_cell_t* cell = scr->back + r * scr->cols;
+
+	for (; r < end; ++r)
+	for (int c = 0; c < scr->cols; ++c)
+	{
+		tg_cell_parse(cell++, job->sampler(r, c));
+	}
+}
+
+/**
+ * @brief      Samples every cell of the screen into the back buffer. With a
+ *             pool attached to the screen the rows are split into bands that
+ *             the pool's threads sample in parallel, each into its own rows
+ *             of the back buffer.
+ *
+ * @param      scr      The screen
+ * @param      sampler  The sampler function pointer, see tg_rasterize
+ */
+void tg_screen_sample(tg_screen_t* scr, const char* (*sampler)(int row, int col))
+{
+	_tg_screen_sample_job_t job = { scr, 1, sampler };
+
+	if (!scr->pool)
+	{
+		_tg_screen_sample_band(&job, 0);
+		return;
+	}
+
+	job.bands = _tg_pool_bands(scr->pool, scr->rows);
+	tg_pool_run(scr->pool, job.bands, _tg_screen_sample_band, &job);
+}
+
+/**
+ * Defines 'name' as a static function, void name(tg_screen_t* scr), that
+ * fills the screen's back buffer from tg_cell_t sampler(int row, int col,
+ * int* run). Unlike the samplers given to tg_screen_sample, 'sampler'
+ * returns the tg_cell_t itself and is called directly, so the compiler can
+ * inline it. '*run' holds the columns left in the row when called and is set
+ * by the sampler to the columns, starting at 'col', that the returned cell
+ * covers. The cell is copied over the run and sampling resumes after it, so
+ * rows made of a few runs cost a call per run rather than one per cell. Rows
+ * are split over the screen's pool like tg_screen_sample does.
+ */
+#define TG_SCREEN_SPAN_SAMPLER(name, sampler) \
+static void name##_band(void* ctx, int band) \
+{ \
+	tg_screen_t* scr = (tg_screen_t*)ctx; \
+	int bands = scr->pool ? _tg_pool_bands(scr->pool, scr->rows) : 1; \
+	int end = (band + 1) * scr->rows / bands; \
+	for (int r = band * scr->rows / bands; r < end; ++r) \
+	{ \
+		tg_cell_t* row = scr->back + r * scr->cols; \
+		for (int c = 0; c < scr->cols;) \
+		{ \
+			int run = scr->cols - c; \
+			tg_cell_t cell = sampler(r, c, &run); \
+			if (run < 1) { run = 1; } \
+			if (run > scr->cols - c) { run = scr->cols - c; } \
+			for (int run_end = c + run; c < run_end; ++c) { row[c] = cell; } \
+		} \
+	} \
+} \
+static void name(tg_screen_t* scr) \
+{ \
+	if (!scr->pool) { name##_band(scr, 0); return; } \
+	tg_pool_run(scr->pool, _tg_pool_bands(scr->pool, scr->rows), name##_band, scr); \
+}
+
+/**
+ * @brief      Fills the back buffer with a single cell. Frames that are
+ *             composited rather than sampled start with this, every layer is
+ *             then drawn over it in painter's order.
+ *
+ * @param      scr   The screen
+ * @param[in]  str   The string every cell is set to, as a sampler would
+ *                   return it
+ */
+void tg_screen_fill(tg_screen_t* scr, const char* str)
+{
+	size_t count = (size_t)scr->rows * scr->cols;
+	tg_cell_t cell;
+
+	tg_cell_parse(&cell, str);
+	for (size_t i = 0; i < count; ++i) { scr->back[i] = cell; }
+}
+
+/**
+ * @brief      Draws a single character with the default rendition into one
+ *             cell of the back buffer. Cells outside of the screen are
+ *             ignored.
+ *
+ * @param      scr   The screen
+ * @param[in]  row   The row
+ * @param[in]  col   The col
+ * @param[in]  c     The character
+ */
+void tg_screen_putc(tg_screen_t* scr, int row, int col, char c)
+{
+	if (row < 0 || col < 0 || row >= scr->rows || col >= scr->cols) { return; }
+
+	*tg_screen_cell(scr, row, col) = (unsigned char)c < 128 ? c : '?';
+}
+
+/**
+ * @brief      Sets one cell of the back buffer. Cells outside of the screen
+ *             are ignored.
+ *
+ * @param      scr   The screen
+ * @param[in]  row   The row
+ * @param[in]  col   The col
+ * @param[in]  cell  The cell, see TG_CELL
+ */
+void tg_screen_set(tg_screen_t* scr, int row, int col, tg_cell_t cell)
+{
+	if (row < 0 || col < 0 || row >= scr->rows || col >= scr->cols) { return; }
+
+	*tg_screen_cell(scr, row, col) = cell;
+}
+
+/**
+ * @brief      Draws a line of text into the back buffer, one character per
+ *             cell. The parts of the text that fall outside of the screen are
+ *             clipped.
+ *
+ * @param      scr       The screen
+ * @param[in]  row       The row
+ * @param[in]  col       The col where the text starts, or its center
+ * @param[in]  text      The text
+ * @param[in]  centered  If non zero the text is centered around 'col'
+ */
+void tg_screen_print(tg_screen_t* scr, int row, int col, const char* text, int centered)
+{
+	int len = strlen(text);
+
+	if (centered) { col -= len >> 1; }
+
+	for (int i = 0; i < len; ++i) { tg_screen_putc(scr, row, col + i, text[i]); }
+}
+
+/**
+ * @brief      Draws every occupied cell of a particle system into the back
+ *             buffer, using the same glyphs tg_sample_particle_sys returns
+ *             in the system's style. Each living particle looks up its cell,
+ *             so the cost depends on the number of particles alive, not on
+ *             the size of the screen or the system's capacity.
+ *
+ * @param      scr   The screen
+ * @param      sys   The particle system
+ */
+void tg_screen_blit_particles(tg_screen_t* scr, tg_particle_system_t const* sys)
+{
+	for (int i = 0; i < sys->_living_count; ++i)
+	{
+		int row, col;
+
+		if (sys->layout == TG_PARTICLES_SOA)
+		{
+			row = (int)sys->soa.y[i];
+			col = (int)sys->soa.x[i];
+		}
+		else
+		{
+			row = (int)sys->particles[i].pos.y;
+			col = (int)sys->particles[i].pos.x;
+		}
+
+		if (row < 0 || col < 0 || row >= scr->rows || col >= scr->cols) { continue; }
+
+		tg_particle_cell_t const* cell = _tg_particle_cell_slot(sys, row, col);
+		if (cell->density == 0) { continue; }
+
+		char c = _tg_particle_cell_glyph(sys, cell);
+		if (c != '\0') { tg_screen_set(scr, row, col, sys->style | (unsigned char)c); }
+	}
+}
+
+/**
+ * Grid of cells that is generated once and drawn into every frame, a
+ * background for instance. A layer tiles, drawing it scrolled by an offset
+ * wraps its cells around, so a layer the size of the screen can be scrolled
+ * forever without showing a seam. Cells that are 0 are transparent.
+ */
+typedef struct {
+	int rows, cols;
+	tg_cell_t* cells;
+	int opaque; // no cell is transparent, the layer is copied whole
+} tg_layer_t;
+
+/**
+ * @brief      Sets the size of the layer, reallocating its cells if the size
+ *             changed. The cells are cleared to transparent when they are.
+ *
+ * @param      layer  The layer
+ * @param[in]  rows   The rows
+ * @param[in]  cols   The cols
+ *
+ * @return     1 if the layer was resized and needs generating, 0 if its
+ *             cells were kept, -1 if they could not be allocated
+ */
+int tg_layer_resize(tg_layer_t* layer, int rows, int cols)
+{
+	if (layer->cells && rows == layer->rows && cols == layer->cols) { return 0; }
+
+	tg_cell_t* cells = (tg_cell_t*)calloc((size_t)rows * cols, sizeof(tg_cell_t));
+	if (!cells) { return -1; }
+
+	free(layer->cells);
+	layer->cells = cells;
+	layer->rows = rows;
+	layer->cols = cols;
+
+	return 1;
+}
+
+/**
+ * @brief      Releases the cells of the layer.
+ *
+ * @param      layer  The layer
+ */
+void tg_layer_free(tg_layer_t* layer)
+{
+	free(layer->cells);
+	memset(layer, 0, sizeof(tg_layer_t));
+}
+
+/**
+ * @brief      Draws a layer over the whole back buffer, scrolled so that the
+ *             layer's cell at 'row', 'col' lands on the top left corner.
+ *             Opaque layers are copied a row span at a time, so the bottom
+ *             layer of a frame costs a couple of memcpy per row.
+ *
+ * @param      scr    The screen
+ * @param      layer  The layer
+ * @param[in]  row    The row offset
+ * @param[in]  col    The col offset
+ */
+void tg_screen_layer(tg_screen_t* scr, tg_layer_t const* layer, int row, int col)
+{
+	if (!layer->cells || layer->rows <= 0 || layer->cols <= 0) { return; }
+
+	row %= layer->rows;
+	col %= layer->cols;
+	if (row < 0) { row += layer->rows; }
+	if (col < 0) { col += layer->cols; }
+
+	for (int r = 0; r < scr->rows; ++r)
+	{
+		tg_cell_t const* src = layer->cells + ((r + row) % layer->rows) * layer->cols;
+		tg_cell_t* dst = scr->back + r * scr->cols;
+
+		for (int c = 0, from = col; c < scr->cols; from = 0)
+		{
+			int run = layer->cols - from;
+			if (run > scr->cols - c) { run = scr->cols - c; }
+
+			if (layer->opaque) { memcpy(dst + c, src + from, run * sizeof(tg_cell_t)); }
+			else for (int i = 0; i < run; ++i)
+			{
+				if (src[from + i]) { dst[c + i] = src[from + i]; }
+			}
+
+			c += run;
+		}
+	}
+}
+
+static void _tg_screen_probes(tg_screen_t* scr)
+{
+	char line[64];
+	tg_probe_stats_t frame = tg_probe_stats(TG_PHASE_FRAME);
+
+	snprintf(line, sizeof(line), " %5.1f fps %6zu B %6zu particles ",
+	         frame.avg > 0 ? 1 / frame.avg : 0, tg_probes.frame_bytes, tg_probes.particles);
+	tg_screen_print(scr, 0, 0, line, 0);
+
+	snprintf(line, sizeof(line), " %-9s %8s %8s %8s us ", "", "min", "avg", "p99");
+	tg_screen_print(scr, 1, 0, line, 0);
+
+	for (int p = 0; p < TG_PHASE_FRAME; ++p)
+	{
+		tg_probe_stats_t stats = tg_probe_stats(p);
+
+		snprintf(line, sizeof(line), " %-9s %8.0f %8.0f %8.0f    ",
+		         _tg_phase_names[p], stats.min * 1e6, stats.avg * 1e6, stats.p99 * 1e6);
+		tg_screen_print(scr, 2 + p, 0, line, 0);
+	}
+
+	for (int i = 0; i < tg_probes.pool_count; ++i)
+	{
+		tg_probe_pool_t const* pool = tg_probes.pools + i;
+
+		snprintf(line, sizeof(line), " %-9s %6zu of %6zu, %zu dropped ",
+		         pool->name, pool->high_water, pool->capacity, pool->dropped);
+		tg_screen_print(scr, 2 + TG_PHASE_FRAME + i, 0, line, 0);
+	}
+}
+
+// writes a cursor movement by 'n', a count of 1 is implied
+static int _tg_screen_csi(char* seq, int n, char cmd)
+{
+	return n == 1 ? sprintf(seq, "\033[%c", cmd) : sprintf(seq, "\033[%d%c", n, cmd);
+}
+
+static void _tg_screen_move(tg_screen_t* scr, int row, int col)
+{
+	char rel[40], abs[32];
+	int rel_len = -1, abs_len = -1;
+
+	if (scr->alternate)
+	{ // the frame sits at the top left so it can be addressed absolutely
+		abs_len = col ? sprintf(abs, "\033[%d;%dH", row + 1, col + 1) : sprintf(abs, "\033[%dH", row + 1);
+	}
+
+	if (scr->_cur_row >= 0)
+	{
+		int cur_col = scr->_cur_col;
+		rel_len = 0;
+
+		if (row < scr->_cur_row) { rel_len += _tg_screen_csi(rel + rel_len, scr->_cur_row - row, 'A'); }
+		else if (row > scr->_cur_row) { rel_len += _tg_screen_csi(rel + rel_len, row - scr->_cur_row, 'B'); }
+
+		if (cur_col < 0 || (col == 0 && cur_col != 0))
+		{
+			rel[rel_len++] = '\r';
+			cur_col = 0;
+		}
+
+		if (col < cur_col) { rel_len += _tg_screen_csi(rel + rel_len, cur_col - col, 'D'); }
+		else if (col > cur_col) { rel_len += _tg_screen_csi(rel + rel_len, col - cur_col, 'C'); }
+	}
+
+	if (rel_len < 0 || (abs_len >= 0 && abs_len < rel_len)) { tg_fb_put(&scr->fb, abs, abs_len); }
+	else { tg_fb_put(&scr->fb, rel, rel_len); }
+
+	scr->_cur_row = row;
+	scr->_cur_col = col;
+}
+
+// writes a color's SGR parameter, 'base' being 30 for the foreground and 40
+// for the background
+static int _tg_screen_color(char* seq, int color, int base)
+{
+	int n = color - 1;
+
+	if (color == TG_DEFAULT) { return sprintf(seq, "%d;", base + 9); }
+	if (n < 8) { return sprintf(seq, "%d;", base + n); }
+	if (n < 16) { return sprintf(seq, "%d;", base + 60 + n - 8); }
+	return sprintf(seq, "%d;5;%d;", base + 8, n);
+}
+
+// switches the terminal's rendition to 'style', sending only what changed
+static void _tg_screen_style(tg_screen_t* scr, tg_cell_t style)
+{
+	static const int attr_codes[] = { 1, 2, 4, 7 };
+	tg_cell_t from = scr->_sgr;
+	char seq[48] = "\033[";
+	int len = 2;
+
+	scr->_sgr = style;
+
+	// attributes can't all be turned off on their own, dropping any of
+	// them starts over from the default rendition
+	if (style == 0 || (tg_cell_attrs(from) & ~tg_cell_attrs(style)))
+	{
+		seq[len++] = '0';
+		seq[len++] = ';';
+		from = 0;
+	}
+
+	for (int a = 0; a < 4; ++a)
+	{
+		int bit = 1 << a;
+		if ((tg_cell_attrs(style) & bit) && !(tg_cell_attrs(from) & bit)) { len += sprintf(seq + len, "%d;", attr_codes[a]); }
+	}
+
+	if (tg_cell_fg(style) != tg_cell_fg(from)) { len += _tg_screen_color(seq + len, tg_cell_fg(style), 30); }
+	if (tg_cell_bg(style) != tg_cell_bg(from)) { len += _tg_screen_color(seq + len, tg_cell_bg(style), 40); }
+
+	seq[len - 1] = 'm';
+	tg_fb_put(&scr->fb, seq, len);
+}
+
+static void _tg_screen_emit(tg_screen_t* scr, tg_cell_t cell)
+{
+	int glyph = tg_cell_glyph(cell);
+
+	if ((cell & TG_CELL_STYLE_MASK) != scr->_sgr) { _tg_screen_style(scr, cell & TG_CELL_STYLE_MASK); }
+
+	if (glyph < 128) { tg_fb_putc(&scr->fb, glyph); }
+	else { tg_fb_puts(&scr->fb, tg_glyphs.bytes[glyph]); }
+}
+
+// cell the terminal leaves behind when characters are deleted
+static const tg_cell_t _tg_blank_cell = ' ';
+
+// shifts row 'r' on the terminal and in 'front' left by 'n' columns, when
+// fewer cells would differ from the back buffer afterwards than before
+static void _tg_screen_scroll_row(tg_screen_t* scr, int r, int n)
+{
+	// moving to the row and deleting costs about this many cells
+	const int overhead = 8;
+	tg_cell_t* f_row = scr->front + (r * scr->cols);
+	tg_cell_t* b_row = scr->back + (r * scr->cols);
+	int kept = 0, shifted = 0;
+
+	for (int c = 0; c < scr->cols; ++c)
+	{
+		tg_cell_t moved = c + n < scr->cols ? f_row[c + n] : _tg_blank_cell;
+		kept += f_row[c] != b_row[c];
+		shifted += moved != b_row[c];
+
+		// stop once the rest of the row can't make shifting pay off
+		if (shifted + overhead >= kept + (scr->cols - c - 1)) { return; }
+	}
+
+	if (shifted + overhead >= kept) { return; }
+
+	// deleted cells are filled in the current rendition
+	if (scr->_sgr)
+	{
+		tg_fb_put(&scr->fb, "\033[0m", 4);
+		scr->_sgr = 0;
+	}
+
+	char seq[16];
+	_tg_screen_move(scr, r, 0);
+	tg_fb_put(&scr->fb, seq, _tg_screen_csi(seq, n, 'P'));
+
+	memmove(f_row, f_row + n, (scr->cols - n) * sizeof(tg_cell_t));
+	for (int c = scr->cols - n; c < scr->cols; ++c) { f_row[c] = _tg_blank_cell; }
+}
+
+// emits 'n' cells, runs of a single byte glyph are sent as the glyph and a
+// REP for the rest when the terminal has it and that is shorter
+static void _tg_screen_emit_cells(tg_screen_t* scr, tg_cell_t const* cells, int n)
+{
+	for (int i = 0; i < n;)
+	{
+		int same = 1;
+
+		_tg_screen_emit(scr, cells[i]);
+
+		if (scr->rep && tg_cell_glyph(cells[i]) < 128)
+		{
+			while (i + same < n && cells[i + same] == cells[i]) { same++; }
+
+			char seq[16];
+			int len = _tg_screen_csi(seq, same - 1, 'b');
+			if (len < same - 1)
+			{
+				tg_fb_put(&scr->fb, seq, len);
+				i += same;
+				continue;
+			}
+		}
 
-	size_t _glyph_count;
-	int _living_count;
-} tg_particle_system_t;
+		for (i++; --same;) { _tg_screen_emit(scr, cells[i++]); }
+	}
+}
 
 /**
- * @brief      Returns a random float.
+ * @brief      Sends the back buffer to the terminal.
+ *             - diff: the first frame, or the first after a resize, is painted
+ *               whole. Later frames only emit the runs of cells that changed.
+ *               On the alternate screen the first frame is diffed against a
+ *               blank one.
+ *             - scroll: after tg_screen_scroll, rows that are cheaper to
+ *               shift than to redraw are shifted with DCH before diffing.
+ *             - SGR: only attributes and colors that change are sent.
+ *             - rep: runs of a character are sent with REP.
+ *             - sync: each frame is one synchronized update.
+ *             - headless: output is discarded, the frame ends up in 'front'.
+ *             The probes overlay, when shown, is drawn over the frame first.
+ *             The cursor is left below the frame, or homed at the start of
+ *             each frame on the alternate screen.
  *
- * @return     Random float in the range [-1, 1]
- */
-float tg_randf() { return (random() % 2048) / 1024.f - 1.f; }
-
-/**
- * @brief      Computes next particle system state (animates) from the previous
- *             state.
+ * @param      scr   The screen
  *
- * @param      sys   The particle system.
+ * @return     0 on success, -1 on a write error
  */
-void tg_update_particle_sys(tg_particle_system_t* sys)
+int tg_screen_present(tg_screen_t* scr)
 {
-	tg_particle_t* parts = sys->particles;
-	if (sys->repulsion > 0)
-	for (int i = sys->_living_count; i--;)
-	for (int j = sys->_living_count; j--;)
-	{
-		if (i == j) continue;
-		float d_x = parts[i].pos.x - parts[j].pos.x;
-		float d_y = parts[i].pos.y - parts[j].pos.y;
+	// runs separated by fewer unchanged cells than this are joined since
+	// reprinting the gap is cheaper than moving the cursor over it
+	const int bridge = 4;
+	tg_cell_t *front = scr->front, *back = scr->back;
+	int scroll = scr->_painted && scr->_scroll < scr->cols ? scr->_scroll : 0;
+	double start = tg_time_sec();
 
-		float dist = sqrtf(d_x * d_x + d_y * d_y);
+	if (tg_probes.overlay) { _tg_screen_probes(scr); }
 
-		if (dist < 0.5f)
-		{
-		float rep_x = (parts[j].vel.x - parts[i].vel.x) * sys->repulsion;//sys->repulsion / (0.01 + d_x * d_x);
-		float rep_y = (parts[j].vel.y - parts[i].vel.y) * sys->repulsion;//sys->repulsion / (0.01 + d_y * d_y);
+	scr->_sgr = 0;
 
-		parts[i].vel.x += rep_x;
-		parts[i].vel.y += rep_y;
-		}
+	// the cursor may have been moved by anything else that was written,
+	// frames on the alternate screen start by homing it
+	if (scr->alternate) { scr->_cur_row = scr->_cur_col = -1; }
+
+	if (scr->sync) { tg_fb_put(&scr->fb, "\033[?2026h", 8); }
+	size_t begin = scr->fb.len;
+
+	if (!scr->_painted && scr->alternate)
+	{ // blank cells are already on the screen, skip over them
+		for (size_t i = (size_t)scr->rows * scr->cols; i--;) { front[i] = _tg_blank_cell; }
 	}
 
-	for (int i = sys->_living_count; i--;)
+	if (!scr->_painted && !scr->alternate)
 	{
-		if (parts[i].life <= 0)
+		tg_fb_reserve(&scr->fb, (size_t)scr->rows * (scr->cols + 1));
+
+		for (int r = 0; r < scr->rows; ++r)
 		{
-			parts[i] = parts[sys->_living_count - 1];
-			sys->_living_count--;
+			_tg_screen_emit_cells(scr, back + (r * scr->cols), scr->cols);
+			tg_fb_putc(&scr->fb, '\n');
 		}
-		else
+	}
+	else for (int r = 0; r < scr->rows; ++r)
+	{
+		tg_cell_t* f_row = front + (r * scr->cols);
+		tg_cell_t* b_row = back + (r * scr->cols);
+
+		if (scroll) { _tg_screen_scroll_row(scr, r, scroll); }
+
+		for (int c = 0; c < scr->cols;)
 		{
-			parts[i].pos.x += parts[i].vel.x;
-			parts[i].pos.y += parts[i].vel.y;
-			parts[i].life--;
+			if (f_row[c] == b_row[c]) { ++c; continue; }
+
+			// find the end of this run of changes, joining nearby runs
+			int end = c + 1, unchanged = 0;
+			for (int i = end; i < scr->cols && unchanged < bridge; ++i)
+			{
+				if (f_row[i] != b_row[i]) { end = i + 1; unchanged = 0; }
+				else { unchanged++; }
+			}
+
+			_tg_screen_move(scr, r, c);
+			_tg_screen_emit_cells(scr, b_row + c, end - c);
+			c = end;
+
+			// the cursor is in an unreliable state after the last column
+			scr->_cur_col = end < scr->cols ? end : -1;
 		}
 	}
+
+	if (scr->_sgr) { tg_fb_put(&scr->fb, "\033[0m", 4); }
+	if (scr->_painted && !scr->alternate) { _tg_screen_move(scr, scr->rows, 0); }
+
+	// frames that changed nothing aren't worth a synchronized update
+	if (scr->sync && scr->fb.len == begin) { scr->fb.len -= 8; }
+	else if (scr->sync) { tg_fb_put(&scr->fb, "\033[?2026l", 8); }
+
+	scr->_painted = 1;
+	scr->_scroll = 0;
+	scr->_cur_row = scr->rows;
+	scr->_cur_col = 0;
+
+	scr->front = back;
+	scr->back = front;
+
+	scr->last_frame_bytes = scr->fb.len;
+
+	int res = 0;
+	if (scr->headless) { scr->fb.len = 0; }
+	else { res = tg_fb_flush(&scr->fb, STDERR_FILENO); }
+
+	scr->last_present_sec = tg_time_sec() - start;
+
+	if (tg_probes.enabled)
+	{
+		tg_probe_record(TG_PHASE_FLUSH, scr->last_present_sec);
+		tg_probes._flush += scr->last_present_sec;
+		tg_probes.frame_bytes = scr->last_frame_bytes;
+		tg_probes.total_bytes += scr->last_frame_bytes;
+	}
+
+	return res;
 }
 
 /**
- * @brief      Passes the row and column of the character being rendered. If
- *             particles exist in that location, a non 0 character will be
- *             returned.
+ * @brief      Samples and presents a frame of 'rows' by 'cols' cells. This
+ *             replaces the tg_clear and tg_rasterize pair, only the cells
+ *             that changed since the last frame are drawn.
  *
- * @param      sys   The particle system.
- * @param[in]  row   The row of the character the terminal is rendering.
- * @param[in]  col   The col of the character the terminal is rendering.
+ * @param      scr      The screen
+ * @param[in]  rows     The number of rows that will be sampled
+ * @param[in]  cols     The number of cols that will be sampled
+ * @param      sampler  The sampler function pointer, see tg_rasterize
  *
- * @return     character to be displayed if there are particles present, 0
- *             otherwise.
+ * @return     0 on success, -1 on failure
  */
-char tg_sample_particle_sys(tg_particle_system_t const* sys, int row, int col)
+int tg_screen_rasterize(tg_screen_t* scr, int rows, int cols, const char* (*sampler)(int row, int col))
 {
-	char c = 0;
-	int density = 0;
+	if (tg_screen_resize(scr, rows, cols)) { return -1; }
 
-	for (int i = sys->_living_count; i--;)
-	{
-		if ((int)sys->particles[i].pos.x == col &&
-		    (int)sys->particles[i].pos.y == row)
-		{
-			density++;
-			if (sys->particles[i].glyph > 0) { c = sys->particles[i].glyph; }
-		}
-	}
+	tg_screen_sample(scr, sampler);
+
+	return tg_screen_present(scr);
+}
+
+/**
+ * @brief      Releases the memory held by the screen.
+ *
+ * @param      scr   The screen
+ */
+void tg_screen_free(tg_screen_t* scr)
+{
+	free(scr->front);
+	free(scr->back);
+	tg_fb_free(&scr->fb);
+	memset(scr, 0, sizeof(tg_screen_t));
+}
+
+// asks the terminal whether it knows synchronized updates (mode 2026)
+static int _tg_screen_query_sync(void)
+{
+	const char* env = getenv("TG_SYNC");
+	if (env && *env) { return *env == '1'; }
+
+	if (!isatty(STDIN_FILENO) || !isatty(STDERR_FILENO)) { return 0; }
+
+	// DECRQM for the mode followed by a primary device attributes request,
+	// which every terminal answers, so that one that ignores DECRQM
+	// doesn't leave us waiting for the whole timeout
+	const char query[] = "\033[?2026$p\033[c";
+	if (write(STDERR_FILENO, query, sizeof(query) - 1) != sizeof(query) - 1) { return 0; }
+
+	char reply[128];
+	size_t len = 0;
+	double deadline = tg_time_sec() + 0.2;
 
-	if (density && c == 0)
+	while (len < sizeof(reply) - 1)
 	{
-		density = density >= sizeof(sys->density_glyphs) ? sizeof(sys->density_glyphs) - 1 : density;
-		c = sys->density_glyphs[density];
+		double left = deadline - tg_time_sec();
+		struct timeval tv = { 0, left > 0 ? (long)(left * 1e6) : 0 };
+		fd_set fds;
+
+		FD_ZERO(&fds);
+		FD_SET(STDIN_FILENO, &fds);
+		if (left <= 0 || select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) <= 0) { break; }
+		if (read(STDIN_FILENO, reply + len, 1) != 1) { break; }
+
+		// the device attributes come last, CSI ? ... c
+		if (reply[len++] == 'c' && memchr(reply, '?', len)) { break; }
 	}
+	reply[len] = '\0';
 
-	return c;
+	// CSI ? 2026 ; Ps $ y, where 1 and 2 mean set and reset
+	const char* report = strstr(reply, "\033[?2026;");
+	int state = report ? atoi(report + 8) : 0;
+
+	return state == 1 || state == 2;
 }
 
 /**
- * @brief      Spawns given particle in the particle system.
+ * @brief      Moves the game onto the alternate screen, whose frames are
+ *             addressed absolutely from its top left corner, leaving the
+ *             shell's screen untouched. Sets 'rep' if terminfo lists REP,
+ *             and asks the terminal whether it supports synchronized
+ *             updates, setting 'sync' if so, TG_SYNC=0 or 1 in the
+ *             environment overrides the answer. Call after
+ *             tg_game_settings and before tg_input_start, the answer is
+ *             read from stdin.
  *
- * @param      sys   The particle system.
- * @param      p     Pointer to particle that will be spawned in the system.
+ * @param      scr   The screen
+ *
+ * @return     0 on success, -1 on a write error
  */
-void tg_spawn_particle(tg_particle_system_t* sys, tg_particle_t* p)
+int tg_screen_open(tg_screen_t* scr)
 {
-	if (sys->_living_count >= sizeof(sys->particles) / sizeof(tg_particle_t)) { return; }
+	if (scr->headless) { return 0; }
 
-	sys->particles[sys->_living_count] = *p;
-	sys->_living_count++;
+	scr->sync = _tg_screen_query_sync();
+	scr->rep = tg_term_load()->rep;
+	scr->alternate = 1;
+	scr->_painted = 0;
+
+	tg_fb_puts(&scr->fb, "\033[?1049h\033[H\033[2J");
+	return tg_fb_flush(&scr->fb, STDERR_FILENO);
 }
 
 /**
- * @brief      Removes all living particles from the system.
+ * @brief      Returns to the screen the game was started from.
  *
- * @param      sys   The particle system.
+ * @param      scr   The screen
+ *
+ * @return     0 on success, -1 on a write error
  */
-void tg_clear_particles(tg_particle_system_t* sys)
+int tg_screen_close(tg_screen_t* scr)
 {
-	sys->_living_count = 0;
+	if (!scr->alternate) { return 0; }
+
+	scr->alternate = 0;
+	scr->_painted = 0;
+
+	tg_fb_puts(&scr->fb, "\033[?1049l");
+	return tg_fb_flush(&scr->fb, STDERR_FILENO);
 }
 
 /**
- * @brief      Sets the terminal up to render a game like yours!
+ * Retained line of text for HUDs. The text is formatted by tg_label_update
+ * only when the key passed to it changes, drawing the label copies the
+ * formatted span into the frame.
+ */
+typedef struct {
+	int row;         // row where the origin of the label should appear.
+	int col;         // col where the origin of the label should appear.
+	const char* fmt; // printf style format string
+	struct {
+		// centered indicates that the label will appear centered around the origin.
+		uint8_t centered : 1;
+	} mode;          // defines the mode of the label's origin
+	tg_cell_t style; // colors and attributes of the text, see TG_CELL
+
+	char     _text[128];
+	size_t   _len;
+	uint64_t _key;
+	uint8_t  _formatted;
+} tg_label_t;
+
+/**
+ * @brief      Hashes a block of memory into a key for tg_label_update, for
+ *             labels whose inputs aren't a single integer.
  *
- * @param      old_settings  The old terminal settings. Keep these to restore
- *                           the previous settings for your terminal.
+ * @param[in]  data  The inputs of the label
+ * @param[in]  len   The size of the inputs in bytes
  *
- * @return     0 on success
+ * @return     64 bit FNV-1a hash of the inputs.
  */
-int tg_game_settings(struct termios* old_settings)
+uint64_t tg_label_key(const void* data, size_t len)
 {
-	struct termios newt;
-
-	// disable echo from stdin
-	tcgetattr(STDIN_FILENO, old_settings);
-	newt = *old_settings;
-	newt.c_lflag &= ~ECHO;
-	newt.c_lflag &= ~ICANON;
-	tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t hash = 14695981039346656037ull;
 
-	// hide cursor
-	fputs("\033[?25l", stderr);
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
 
-	return 0;
+	return hash;
 }
 
 /**
- * @brief      Restores a previously saved terminal settings object.
+ * @brief      Formats the label's text, unless it was already formatted with
+ *             the same key. The key must change whenever the variadic inputs
+ *             would produce different text.
  *
- * @param      old_settings  The old terminal settings.
+ * @param      label      The label
+ * @param[in]  key        Key identifying the inputs, see tg_label_key
+ * @param[in]  <unnamed>  variadic input to the label's format string
  *
- * @return     0 on success
+ * @return     1 if the text was formatted again, 0 if it was up to date.
  */
-int tg_restore_settings(struct termios* old_settings)
+int tg_label_update(tg_label_t* label, uint64_t key, ...)
 {
-	tcsetattr(STDIN_FILENO, TCSANOW, old_settings);
-	fputs("\033[?25h", stderr);
+	if (label->_formatted && label->_key == key) { return 0; }
 
-	return 0;
-}
+	va_list ap;
+
+	va_start(ap, key);
+	int len = vsnprintf(label->_text, sizeof(label->_text), label->fmt, ap);
+	va_end(ap);
+
+	if (len < 0) { len = 0; }
+	label->_len = (size_t)len < sizeof(label->_text) ? (size_t)len : sizeof(label->_text) - 1;
+	label->_key = key;
+	label->_formatted = 1;
 
+	return 1;
+}
 
 /**
- * @brief      Get the current width in columns of the terminal
+ * @brief      Draws the label's last formatted text into the screen's back
+ *             buffer. Labels that were never updated are formatted without
+ *             arguments first, which suits labels with constant text.
  *
- * @return     width in columns, -1 if the value cannot be retrieved
+ * @param      scr    The screen
+ * @param      label  The label
  */
-int tg_term_width()
+void tg_screen_label(tg_screen_t* scr, tg_label_t* label)
 {
-	char buf[2048];
-	if (tgetent(buf, getenv("TERM")) >= 0)
+	if (!label->_formatted) { tg_label_update(label, 0); }
+
+	int col = label->col;
+	if (label->mode.centered) { col -= label->_len >> 1; }
+
+	for (size_t i = 0; i < label->_len; ++i)
 	{
-		return tgetnum((char*)"co");
+		char c = label->_text[i];
+		tg_screen_set(scr, label->row, col + i, label->style | ((unsigned char)c < 128 ? c : '?'));
 	}
-
-	return -1;
 }
 
 /**
- * @brief      Get the current height in rows of the terminal
+ * Headless benchmark of a game. Set the TG_BENCH environment variable to a
+ * space separated list of settings to run a game through it, for instance
+ * TG_BENCH="frames=2000 size=200x60 keys=90.iijjkkll" where size is columns
+ * by rows and keys holds the key pressed on each tick, '.' for none, and is
+ * repeated for as long as the run lasts. A count before a key repeats it for
+ * that many ticks.
+ */
+typedef struct {
+	const char* name; // name of the game in the report
+	int frames;       // ticks to run, each followed by a frame
+	int rows, cols;
+	char keys[1024];
+
+	struct {
+		double update;  // time spent in input and update
+		double sample;  // time spent sampling or compositing frames
+		double output;  // time spent diffing and emitting frames
+		size_t bytes;   // bytes emitted
+	} total;
+} tg_bench_t;
+
+/**
+ * @brief      Reads the benchmark settings from the TG_BENCH environment
+ *             variable. Unset settings default to 1000 frames of 80x24 with
+ *             no keys pressed, invalid ones are reported and ignored.
  *
- * @return     height in rows, -1 if the value cannot be retrieved
+ * @param      bench  The benchmark
+ *
+ * @return     1 if TG_BENCH is set and the game should run the benchmark,
+ *             0 otherwise.
  */
-int tg_term_height()
+int tg_bench_config(tg_bench_t* bench)
 {
-	char buf[2048];
-	if (tgetent(buf, getenv("TERM")) >= 0)
+	const char* env = getenv("TG_BENCH");
+	if (!env) { return 0; }
+
+	bench->frames = 1000;
+	bench->cols = 80;
+	bench->rows = 24;
+	strcpy(bench->keys, ".");
+
+	char settings[512], *save = NULL;
+	snprintf(settings, sizeof(settings), "%s", env);
+
+	for (char* tok = strtok_r(settings, " ", &save); tok; tok = strtok_r(NULL, " ", &save))
 	{
-		return tgetnum((char*)"li");
+		int frames, cols, rows;
+
+		if (sscanf(tok, "frames=%d", &frames) == 1 && frames > 0)
+		{
+			bench->frames = frames;
+			continue;
+		}
+
+		if (sscanf(tok, "size=%dx%d", &cols, &rows) == 2 && cols > 0 && rows > 0)
+		{
+			bench->cols = cols;
+			bench->rows = rows;
+			continue;
+		}
+
+		if (!strncmp(tok, "keys=", 5) && tok[5])
+		{
+			size_t len = 0;
+			for (char* k = tok + 5; *k;)
+			{
+				int count = 1;
+				if (*k >= '0' && *k <= '9') { count = strtol(k, &k, 10); }
+				if (!*k) { break; }
+
+				for (; count-- && len < sizeof(bench->keys) - 1; ++len) { bench->keys[len] = *k; }
+				++k;
+			}
+
+			if (len) { bench->keys[len] = '\0'; }
+			continue;
+		}
+
+		fprintf(stderr, "TG_BENCH: ignoring setting '%s'\n", tok);
 	}
 
-	return -1;
+	return 1;
 }
 
 /**
- * @brief      Returns a key pressed withing TG_TIMEOUT microseconds
- *
- * @param      key   The key character pressed
+ * @brief      Runs the game's loop callbacks back to back, without sleeping,
+ *             for the configured number of frames, or until the loop's
+ *             playing callback says the game is over, and prints the time
+ *             spent per frame in each phase along with the bytes the frames
+ *             would have written to the terminal. The screen is switched to
+ *             headless and scripted keys are fed through 'in', whose reader
+ *             thread must not be running.
  *
- * @return     1 if a key is pressed, 0 otherwise.
+ * @param      bench  The benchmark
+ * @param      loop   The game's loop, only its callbacks are used
+ * @param      scr    The screen the game's render callback presents
+ * @param      in     The input the game's input callback drains
  */
-int tg_key_get(char* key)
+void tg_bench_run(tg_bench_t* bench, tg_loop_t* loop, tg_screen_t* scr, tg_input_t* in)
 {
-	fd_set fds;
-	struct timeval tv = { 0, TG_TIMEOUT };
-
-	FD_ZERO(&fds);
-	FD_SET(STDIN_FILENO, &fds);
+	size_t key_count = strlen(bench->keys);
 
-#ifdef __linux__
-	__fpurge(stdin);
-#elif defined(__APPLE__)
-	fpurge(stdin);
-#endif
+	// measure what an xterm compatible terminal would be sent
+	scr->headless = 1;
+	scr->rep = 1;
+	memset(&bench->total, 0, sizeof(bench->total));
 
-	switch(select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv))
+	int f = 0;
+	for (; f < bench->frames && (!loop->playing || loop->playing()); ++f)
 	{
-		case 0:  // timeout
-		case -1: // error
-			return 0;
+		char key = bench->keys[f % key_count];
+		if (key != '.') { tg_input_inject(in, key); }
+
+		double start = tg_time_sec();
+		if (loop->input) { loop->input(); }
+		loop->update();
+		double updated = tg_time_sec();
+		loop->render(0);
+		double rendered = tg_time_sec();
+
+		bench->total.update += updated - start;
+		bench->total.sample += (rendered - updated) - scr->last_present_sec;
+		bench->total.output += scr->last_present_sec;
+		bench->total.bytes += scr->last_frame_bytes;
 	}
 
-	usleep(tv.tv_usec); // wait the remaining timeout
+	double per_frame = f ? 1e9 / f : 0;
+	printf("%-8s %4dx%-3d %2d thr  update %9.0f  sample %9.0f  output %9.0f ns/frame  %8.0f bytes/frame",
+	       bench->name, bench->cols, bench->rows, scr->pool ? scr->pool->threads + 1 : 1,
+	       bench->total.update * per_frame,
+	       bench->total.sample * per_frame,
+	       bench->total.output * per_frame,
+	       f ? (double)bench->total.bytes / f : 0);
 
-	return read(STDIN_FILENO, key, sizeof(char)) == sizeof(char);
+	if (f < bench->frames) { printf("  (game over after %d frames)", f); }
+	putchar('\n');
 }
 
 /**
- * Context for drawing a string in the game.
+ * How a game runs: benchmarked when TG_BENCH is set, otherwise played on the
+ * terminal, optionally recorded or replayed, see tg_record_open. The session
+ * functions do the start up and shut down every game shares around the
+ * game's own setup:
+ *
+ *   tg_session_begin   settings, size and seed the game starts with
+ *   tg_session_open    terminal, screen and input when playing on it
+ *   tg_session_run     the benchmark or the game loop
+ *   tg_session_end     restores the terminal and ends the recording
  */
 typedef struct {
-	int row;         // row where the origin of the string should appear.
-	int col;         // col where the origin of the string should appear.
-	const char* fmt; // printf style format string
-	struct {
-		// centered indicates that the string will appear centered around the origin.
-		uint8_t centered : 1;
-	} mode;          // defines the mode of the format string's origin
+	const char* name;          // name of the game in reports and errors
+	tg_screen_t* screen;
+	tg_input_t* input;
+	void (*print_state)(void); // prints the final state of a recorded or replayed session, for comparing replays
 
-	char   _buf[1024];
-	size_t _len;
-} tg_str_t;
+	int benchmarking;          // running TG_BENCH rather than the loop
+	int interactive;           // drawing to and reading keys from the terminal
+	int rows, cols;            // size the game starts with
+	uint64_t seed;             // seed the game starts with
+	tg_bench_t bench;
+	tg_record_t record;
+
+	struct termios _settings;  // terminal settings to restore
+	double _elapsed;           // seconds the loop ran
+} tg_session_t;
 
 /**
- * @brief      Samples a string in the game.
+ * @brief      Reads the benchmark, probe and recording settings from the
+ *             environment and decides the size and seed the game starts
+ *             with, which it should take from 'rows', 'cols' and 'seed'
+ *             afterwards.
  *
- * @param[in]  row        The row
- * @param[in]  col        The col
- * @param      ctx        The string context
- * @param[in]  <unnamed>  variadic input to context's format string
+ * @param      s     The session, with its name, screen and input set
+ * @param[in]  rows  The rows the game would start with
+ * @param[in]  cols  The cols the game would start with
  *
- * @return     { description_of_the_return_value }
+ * @return     0 on success, -1 if the recording couldn't be opened, which
+ *             has been reported.
  */
-int tg_str(int row, int col, tg_str_t* ctx, ...)
+int tg_session_begin(tg_session_t* s, int rows, int cols)
 {
-	va_list ap;
-
-	va_start(ap, ctx);
-	vsnprintf(ctx->_buf, sizeof(ctx->_buf), ctx->fmt, ap);
-	va_end(ap);
+	s->bench.name = s->name;
+	s->benchmarking = tg_bench_config(&s->bench);
+	tg_probes_config();
 
-	ctx->_len = strlen(ctx->_buf);
+	if (s->benchmarking)
+	{ // fixed size and seed so runs are comparable
+		s->rows = s->bench.rows;
+		s->cols = s->bench.cols;
+		s->seed = 0;
+		s->interactive = 0;
+		return 0;
+	}
 
-	if (row != ctx->row) { return -1; }
+	tg_term_load();
 
-	int adj_col = ctx->col;
-	if (ctx->mode.centered) { adj_col -= ctx->_len >> 1; }
-	if (col >= adj_col && col < adj_col + ctx->_len)
+	if (tg_record_open(&s->record, time(NULL), rows, cols))
 	{
-		int i = col - adj_col;
-		return ctx->_buf[i];
+		fprintf(stderr, "%s: recording: %s\n", s->name, strerror(errno));
+		return -1;
 	}
 
-	return -1;
+	s->rows = s->record.rows;
+	s->cols = s->record.cols;
+	s->seed = s->record.seed;
+	s->screen->headless = s->record.headless;
+	s->interactive = !s->record.headless;
+
+	// resizes change the game but aren't recorded, recorded and replayed
+	// sessions keep the size they started at
+	if (s->record.mode == TG_RECORD_OFF) { tg_term_watch_resize(); }
+	tg_watch_interrupt();
+
+	return 0;
 }
 
 /**
- * @brief      Erases the last 'rows' number of lines from the terminal
- * and moves the cursor back up that same number of rows. This is intended
- * to get ready for drawing a new frame.
+ * @brief      Sets the terminal up, opens the screen and starts reading keys
+ *             if the session is interactive. Call once the game is ready to
+ *             draw its first frame.
  *
- * @param[in]  rows  The rows to clear
+ * @param      s     The session
  */
-void tg_clear(int rows)
+void tg_session_open(tg_session_t* s)
 {
-	static char move_up[16] = {};
-	sprintf(move_up, "\033[%dA", rows);
-	fprintf(stderr, "%s", move_up);
+	if (!s->interactive) { return; }
+
+	tg_game_settings(&s->_settings);
+	tg_screen_open(s->screen);
+	tg_input_start(s->input);
 }
 
 /**
- * @brief      tg_rasterize simply iterates over each row and column from 0 to
- * 'rows' and 0 to 'cols' for each row-col pair. With each pair, the `sampler`
- * function pointer is called. This function pointer is user provided. And allows
- * the programmer's game to dictate what should be displayed in each row-col pair
- * by returning a pointer to the appropriate character.
+ * @brief      Runs the benchmark, or the game loop with the session's
+ *             recording followed by a last frame.
  *
- * @param[in]  rows     The number of rows that will be sampled
- * @param[in]  cols     The number of cols that will be sampled
- * @param      sampler  The sampler function pointer, whose purpose is described
- *                      above
+ * @param      s     The session
+ * @param      loop  The game's loop
  */
-void tg_rasterize(int rows, int cols, const char* (*sampler)(int row, int col))
+void tg_session_run(tg_session_t* s, tg_loop_t* loop)
 {
-	for (int r = 0; r < rows; ++r)
+	if (s->benchmarking)
 	{
-		for (int c = 0; c < cols; ++c)
-		{
-			const char* glyph = sampler(r, c);
-			fprintf(stderr, "%s", glyph);
-		} fputc('\n', stderr);
+		tg_bench_run(&s->bench, loop, s->screen, s->input);
+		return;
+	}
+
+	loop->record = &s->record;
+	s->input->record = &s->record;
+
+	double started = tg_time_sec();
+	tg_loop_run(loop);
+	s->_elapsed = tg_time_sec() - started;
+	loop->render(0);
+}
+
+/**
+ * @brief      Restores the terminal, writes the probes, reports how long a
+ *             replay took and ends the recording, printing the game's final
+ *             state for recorded and replayed sessions.
+ *
+ * @param      s     The session
+ * @param      loop  The loop tg_session_run ran
+ */
+void tg_session_end(tg_session_t* s, tg_loop_t const* loop)
+{
+	if (s->interactive)
+	{
+		tg_input_stop(s->input);
+		tg_screen_close(s->screen);
+		tg_restore_settings(&s->_settings);
+	}
+
+	if (s->benchmarking) { return; }
+
+	tg_probes_finish();
+
+	if (s->record.mode == TG_RECORD_REPLAY)
+	{
+		printf("replayed %llu ticks, %llu frames in %.3fs\n",
+		       (unsigned long long)loop->stats.ticks, (unsigned long long)loop->stats.frames, s->_elapsed);
+	}
+
+	if (s->record.mode != TG_RECORD_OFF)
+	{
+		tg_record_close(&s->record);
+		if (s->print_state) { s->print_state(); }
 	}
 }
 
@@ -9,6 +9,15 @@
 
 #include "tg.h"
 
+#define TICK_HZ 10
+
+// the world is generated this many columns at a time, ahead of the screen
+#define CHUNK_COLS 64
+
+// the gap's width is modulated by |sin(x / 10)|, tabulated over one period
+#define WIDTH_STEPS 256
+#define WIDTH_PHASE_STEP ((uint32_t)(WIDTH_STEPS * 65536 / (10 * M_PI)))
+
 int TG_TIMEOUT = 100000;
 
 struct {
@@ -26,95 +35,176 @@ struct {
 	} player;
 	
 	struct {
-		opening_t gaps[512];	
+		opening_t* gaps; // ring of generated columns, column x is at x & mask
+		int mask;
+		int generated;   // columns generated so far
+		uint32_t phase;  // width modulation of the next column, 16.16 steps
 		int gap_size;
 		int x;
 	} world;
 
-	time_t start_time;
-	time_t last_shrank;
+	int ticks; // time is kept in ticks so replays match
+	int last_shrank;
 	int paused;
+	tg_rng_t rng;
 } game = {
 	.player = { 1, 3 },
 };
 
-struct termios oldt;
 
-void sig_winch_hndlr(int sig)
+tg_screen_t screen;
+tg_input_t input;
+tg_pool_t pool;
+
+// benchmarks steer the player down the middle of the tunnel so the run
+// lasts, scripted keys only move it left and right
+int autopilot;
+
+static float width_mod[WIDTH_STEPS];
+
+
+static inline opening_t* gap_at(int x)
+{
+	return game.world.gaps + (x & game.world.mask);
+}
+
+
+// makes room in the ring for a screen 'cols' wide plus a chunk ahead of it,
+// only allocates when the screen grew wider than the ring
+int reserve_world(int cols)
+{
+	int size = CHUNK_COLS;
+	while (size < cols + 2 * CHUNK_COLS) { size <<= 1; }
+
+	if (game.world.gaps && size <= game.world.mask + 1) { return 0; }
+
+	opening_t* gaps = (opening_t*)malloc(size * sizeof(opening_t));
+	if (!gaps) { return -1; }
+
+	// keep the columns that are still ahead of the screen's left edge
+	for (int x = game.world.x; x < game.world.generated; ++x) { gaps[x & (size - 1)] = *gap_at(x); }
+
+	free(game.world.gaps);
+	game.world.gaps = gaps;
+	game.world.mask = size - 1;
+
+	return 0;
+}
+
+
+// only the width follows the terminal, the tunnel keeps its height
+void read_term_size()
 {
-	term.max_cols = tg_term_width();
-	if (term.max_cols < 0)
+	int cols = tg_term_width();
+	if (cols < 0)
 	{
-		term.max_cols = 80;
+		cols = 80;
 	}
+
+	// the screen only widens if the world has room for it
+	if (game.world.gaps && reserve_world(cols)) { return; }
+	term.max_cols = cols;
 }
 
 
-void sig_int_hndlr(int sig)
+void print_state()
 {
-	tg_restore_settings(&oldt);
-	exit(1);
+	printf("ticks=%d world.x=%d player=%d,%d gap_size=%d\n",
+	       game.ticks, game.world.x, game.player.x, game.player.y, game.world.gap_size);
 }
 
 
 void input_hndlr()
 {
-	char c;
-	if (tg_key_get(&c) == 0)
-	{
-		game.player.dx = game.player.dy = 0;
-		return;
-	}
+	tg_key_event_t ev;
+
+	game.player.dx = game.player.dy = 0;
 
-	switch(c)
+	// each key pressed since the last tick moves the player a cell
+	while (tg_input_next(&input, &ev))
+	switch(ev.key)
 	{
+		case TG_KEY_UP:
 		case 'i':
-			game.player.dy = -1;
+			game.player.dy--;
 			break;
+		case TG_KEY_DOWN:
 		case 'k':
-			game.player.dy = 1;
+			game.player.dy++;
 			break;
+		case TG_KEY_LEFT:
 		case 'j':
-			game.player.dx = -1;
+			game.player.dx--;
 			break;
+		case TG_KEY_RIGHT:
 		case 'l':
-			game.player.dx = 1;
+			game.player.dx++;
 			break;
-		default:
-			game.player.dy = 0;
+		case 'f':
+			tg_probes_toggle_overlay();
+			break;
+	}
+
+	if (autopilot)
+	{ // aim for the column the player is about to enter
+		opening_t* gap = gap_at(game.player.x + game.player.dx + game.world.x + 1);
+		game.player.dy = (gap->top + gap->bottom) / 2 - game.player.y;
 	}
 }
 
 
-static inline const char* sampler(int row, int col)
+// cells the tunnel is drawn with
+enum { CELL_OPEN, CELL_WALL, CELL_PLAYER };
+static const tg_cell_t cells[] = {
+	[CELL_OPEN] = TG_CELL(' ', TG_DEFAULT, TG_DEFAULT, 0),
+	[CELL_WALL] = TG_CELL('X', TG_DEFAULT, TG_DEFAULT, 0),
+	[CELL_PLAYER] = TG_CELL('>', TG_COLOR(2), TG_DEFAULT, 0),
+};
+
+static inline int is_wall(int row, int x)
 {
-	if (row == game.player.y)
-	if (col == game.player.x)
-		return "\033[0;32m>\033[0m";
+	opening_t* gap = gap_at(x);
+	return row < gap->top || row > gap->bottom;
+}
 
-	opening_t* gap = game.world.gaps + ((col + game.world.x) % term.max_cols);
-	
-	if (row < gap->top || row > gap->bottom)
-		return "X";
+// rows are runs of wall and open cells, broken by the player
+static inline tg_cell_t sampler(int row, int col, int* run)
+{
+	if (row == game.player.y && col <= game.player.x)
+	{
+		if (col == game.player.x)
+		{
+			*run = 1;
+			return cells[CELL_PLAYER];
+		}
 
-	return " ";
+		if (game.player.x - col < *run) { *run = game.player.x - col; }
+	}
+
+	int x = col + game.world.x, end = x + *run;
+	int wall = is_wall(row, x);
+
+	for (*run = 1; x + *run < end && is_wall(row, x + *run) == wall; ++*run);
+
+	return cells[wall ? CELL_WALL : CELL_OPEN];
 }
 
+TG_SCREEN_SPAN_SAMPLER(sample_tunnel, sampler)
+
 
 static inline int is_dead()
 {
-	int x = game.player.x + game.world.x;
-	opening_t* gap = game.world.gaps + (x % term.max_cols);
-	return game.player.y < gap->top || game.player.y > gap->bottom; 
+	return is_wall(game.player.y, game.player.x + game.world.x);
 }
 
 
 void next_gap(opening_t* next, opening_t* last)
 {
-	int delta = (random() % 3) - 1;
+	int delta = (int)tg_rng_below(&game.rng, 3) - 1;
 
 	int top = last->top + delta;
-	int gap = (fabs(sin(game.world.x / 10.f)) + 1.f) * game.world.gap_size;
+	int gap = width_mod[(game.world.phase >> 16) & (WIDTH_STEPS - 1)] * game.world.gap_size;
+	game.world.phase += WIDTH_PHASE_STEP;
 	int max_top = term.max_rows - gap;
 	if (top > max_top) top = max_top;
 	if (top < 0) top = 0; 
@@ -124,9 +214,47 @@ void next_gap(opening_t* next, opening_t* last)
 }
 
 
+// generates chunks until the column past the right edge of the screen exists
+void generate_world()
+{
+	while (game.world.generated <= game.world.x + term.max_cols)
+	for (int i = CHUNK_COLS; i--;)
+	{
+		int x = game.world.generated++;
+		next_gap(gap_at(x), gap_at(x - 1));
+	}
+}
+
+
+int playing()
+{
+	return !is_dead();
+}
+
+
+void render(float alpha)
+{
+	if (tg_term_resized())
+	{
+		read_term_size();
+		generate_world();
+	}
+
+	if (tg_screen_resize(&screen, term.max_rows, term.max_cols)) { return; }
+
+	// the tunnel moves left a column per tick, shift what's on screen
+	static int drawn_x;
+	tg_screen_scroll(&screen, game.world.x - drawn_x);
+	drawn_x = game.world.x;
+
+	sample_tunnel(&screen);
+	tg_screen_present(&screen);
+}
+
+
 int time_played()
 {
-	return time(NULL) - game.start_time;
+	return game.ticks / TICK_HZ;
 }
 
 #define CLAMP(x, min, max) (x > max ? max : (x < min ? min : x))
@@ -134,6 +262,8 @@ void update()
 {
 	int dy = game.player.dy;	
 	int dx = game.player.dx;
+
+	game.ticks++;
 	
 	game.player.x += dx;
 	game.player.y += dy;
@@ -149,59 +279,79 @@ void update()
 		game.world.gap_size--;
 	}
 
-	opening_t* last = game.world.gaps + ((game.world.x + term.max_cols - 2) % term.max_cols);
-	opening_t* next = game.world.gaps + ((game.world.x - 1) % term.max_cols);
-
-	next_gap(next, last);
-
+	generate_world();
 }
 
 
 int main(int argc, char* argv[])
 {
-    srand(time(NULL));
-	signal(SIGWINCH, sig_winch_hndlr);
-	signal(SIGINT, sig_int_hndlr);
-	sig_winch_hndlr(0);
+	tg_session_t session = {
+		.name = "tunnel",
+		.screen = &screen,
+		.input = &input,
+		.print_state = print_state,
+	};
 
-	printf("Controls:\n\ti & k - move up and down\n\tj & l - move left and right\nStarting in ");
-	
-	for(int i = 3; i--;)
-	{
-		printf("%d ", i + 1);
-		fflush(stdout);
-		sleep(1);
-	} putchar('\n'); 
+	read_term_size();
+	if (tg_session_begin(&session, term.max_rows, term.max_cols)) { return 1; }
 
-	tg_game_settings(&oldt);
+	term.max_rows = session.rows;
+	term.max_cols = session.cols;
+	autopilot = session.benchmarking;
 
-	game.world.gap_size = 7;
-	int top = 0; 
+	tg_rng_seed(&game.rng, session.seed);
 
-	game.world.gaps[0].top = 0;
-	game.world.gaps[0].bottom = term.max_rows - 1;
-	opening_t* last = game.world.gaps;
+	// the sampler only reads the game's state, rows can be sampled in parallel
+	tg_pool_start(&pool, 0);
+	screen.pool = &pool;
 
-	for (int i = 1; i < term.max_cols; ++i)
+	if (session.interactive && session.record.mode != TG_RECORD_REPLAY)
 	{
-		if (game.world.gap_size > term.max_rows) { game.world.gap_size--; }
-
-		next_gap(game.world.gaps + i, last);
-		last = game.world.gaps + i;
+		printf("Controls:\n\ti & k - move up and down\n\tj & l - move left and right\n\tf - toggle stats\nStarting in ");
+
+		for(int i = 3; i-- && !tg_interrupted();)
+		{
+			printf("%d ", i + 1);
+			fflush(stdout);
+			sleep(1);
+		} putchar('\n');
 	}
 
-	game.start_time = time(NULL);
+	tg_session_open(&session);
 
-	while (1)
+	for (int i = WIDTH_STEPS; i--;) { width_mod[i] = 1.f + sinf(M_PI * i / WIDTH_STEPS); }
+
+	if (reserve_world(term.max_cols))
 	{
-		input_hndlr();
-		update();
-		tg_rasterize(term.max_rows, term.max_cols, sampler);
-        if (is_dead()) { break; }
-		tg_clear(term.max_rows);
+		perror("tunnel: world");
+		return 1;
 	}
 
-	tg_restore_settings(&oldt);
+	game.world.gap_size = 7;
+	if (game.world.gap_size > term.max_rows) { game.world.gap_size = term.max_rows; }
+
+	// the world starts open
+	game.world.gaps[0].top = 0;
+	game.world.gaps[0].bottom = term.max_rows - 1;
+	game.world.generated = 1;
+	game.world.phase = WIDTH_PHASE_STEP;
+	generate_world();
+
+	tg_loop_t loop = {
+		.tick_hz = TICK_HZ,
+		.render_hz = TICK_HZ,
+		.input = input_hndlr,
+		.update = update,
+		.render = render,
+		.playing = playing,
+	};
+
+	tg_session_run(&session, &loop);
+	tg_session_end(&session, &loop);
+	tg_pool_stop(&pool);
+
+	if (session.benchmarking) { return 0; }
+
 	printf("\nSCORE: %d\n", game.world.x);
 
 	return 1;